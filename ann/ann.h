@@ -5,93 +5,163 @@
 #include <cmath>
 #include "../random/random.h"
 #include "../dataset/dataset.h"
+#include "../dataset/chunked_dataset.h"
 #include "../statistics/statistics.h"
+#include "gemm.h"
+#include "activation.h"
 #include <iostream>
 #include <cassert>
 
-class node; // forward declaration
+template<typename T> class basic_node; // forward declaration
 
-struct connection {
-	double weight;
-	node* target;
-	node* source;
+/// the weight lives in the network's contiguous weight buffer (see neural_net::weights)
+template<typename T>
+struct basic_connection {
+	T *weight;
+	basic_node<T>* target;
+	basic_node<T>* source;
 };
 
-class node {
+template<typename T>
+class basic_node {
 	public:
-		virtual ~node() {}
-		double value; /// every node has a cached output value
-		std::vector<connection*> connections;
-		double delta; /// used by the backpropagation algorithm
+		virtual ~basic_node() {}
+		T *value; /// every node has a cached output value (points into neural_net::values)
+		std::vector<basic_connection<T>*> connections;
+		T delta; /// used by the backpropagation algorithm
         virtual void update() {}
-		void update_value(double x) { value = x; } 
+		void update_value(T x) { *value = x; }
 };
 
-class input : public node {
+template<typename T>
+class basic_input : public basic_node<T> {
 	public:
-		int index; // input index (which column from the dataset)
+		int index; // input index (which input feature from the dataset, see dataset::row())
 };
 
-class neuron : public node {
+template<typename T>
+class basic_neuron : public basic_node<T> {
 	public:
-		virtual double func(double x) = 0; // activation function
+		virtual T func(T x) = 0; // activation function
 
-		double deriv() const { return d; }
-		double deriv2() const { return d2; }
-		double bias;
+		T deriv() const { return *d; }
+		T deriv2() const { return *d2; }
+		T *bias;
 
-	protected:
-		double d, d2; // first- and second-order derivatives
+		T *d, *d2; // first- and second-order derivatives
 };
 
-class perceptron : public neuron {
+template<typename T>
+class basic_perceptron : public basic_neuron<T> {
 	public:
 		/// this activation function is recommended in http://yann.lecun.com/exdb/publis/pdf/lecun-98b.pdf
 		/// f = 1.7159 * tanh(2/3 x)
-		double func(double x) {
+		T func(T x) {
 			return b * std::tanh(c * x);
 		}
 
 		void update() {
-			double s = 0.0; // weighted sum of inputs and connection weights
-			for (auto c : connections) {
+			T s = *this->bias; // weighted sum of inputs and connection weights
+			for (auto c : this->connections) {
 				if (this == c->source) continue;
-				s += c->source->value * c->weight;
+				s += *c->source->value * *c->weight;
 			}
 			/// update value and derivatives
-			value = func(s);
-			d = b * c - c / b * value * value;
-			d2 = -2 * c / b * value * d;
+			*this->value = func(s);
+			*this->d = b * c - c / b * *this->value * *this->value;
+			*this->d2 = -2 * c / b * *this->value * *this->d;
 		}
 
 	private:
-		const double b = 1.7159, c = 2.0 / 3.0;
+		const T b = 1.7159, c = 2.0 / 3.0;
 };
 
-class output : public neuron {
+template<typename T>
+class basic_output : public basic_neuron<T> {
 	public:
-		double func(double x) { return x; } // the output neuron passes the input unchanged
+		T func(T x) { return x; } // the output neuron passes the input unchanged
 		void update() {
-			double s = 0.0; // weighted sum of inputs and connection weights
-			for (auto c : connections) {
+			T s = *this->bias; // weighted sum of inputs and connection weights
+			for (auto c : this->connections) {
 				if (this == c->source) continue;
-				s += c->source->value * c->weight;
+				s += *c->source->value * *c->weight;
 			}
 			/// update value and derivatives
-			value = func(s);
-			d = 1;
-			d2 = 0;
+			*this->value = func(s);
+			*this->d = 1;
+			*this->d2 = 0;
 		}
 };
 
-typedef std::vector<node*> layer;
+template<typename T>
+using basic_layer = std::vector<basic_node<T>*>;
 
-class neural_net {
+/// the graph of a double network, as used by the trainers that walk it
+typedef basic_connection<double> connection;
+typedef basic_node<double> node;
+typedef basic_input<double> input;
+typedef basic_neuron<double> neuron;
+typedef basic_perceptron<double> perceptron;
+typedef basic_output<double> output;
+typedef basic_layer<double> layer;
+
+/// compiled form of one non-input layer: a (size x fan_in) row-major weight matrix and a bias vector.
+/// all offsets index into the flat buffers owned by neural_net.
+struct dense_layer {
+	int size; // number of neurons in this layer
+	int fan_in; // number of neurons in the previous layer
+	size_t weight_offset; // into neural_net::weights
+	size_t bias_offset; // into neural_net::biases
+	size_t input_offset; // into neural_net::values (activations of the previous layer)
+	size_t value_offset; // into neural_net::values, derivs and derivs2
+	activation_type activation;
+};
+
+/// scratch buffers for update_batch(). the activations of every layer are kept as a
+/// (rows x layer size) row-major block, so the derivatives are available to batched trainers.
+/// concurrent callers of update_batch() need one workspace each.
+template<typename T>
+struct basic_batch_workspace {
+	basic_batch_workspace() : capacity(0) {}
+	int capacity; // number of rows the buffers can hold
+	std::vector<T> values, derivs;
+	std::vector<T> deltas; // same layout, only allocated by backward_batch()
+};
+
+typedef basic_batch_workspace<double> batch_workspace;
+
+/// The network is stored as contiguous per-layer weight matrices, bias vectors and activation buffers.
+/// The node/connection graph is kept as a view over these buffers (every pointer inside a node or a
+/// connection points into them), so code written against the graph keeps working, while update() runs
+/// as a sequence of dense matrix-vector products.
+///
+/// T is the scalar type of the weights, the activations and the datasets the network reads: neural_net works
+/// in double, basic_neural_net<float> in single precision (twice the values per vector instruction, half the
+/// memory traffic). The gradient trainers (see train.h) work on neural_net.
+template<typename T>
+class basic_neural_net {
 public:
-	std::vector<layer> layers;
-	std::vector<connection*> connections;
+	typedef T value_type;
+	typedef basic_dataset<T> dataset_type;
+	typedef basic_batch_workspace<T> workspace_type;
+
+	std::vector<basic_layer<T>> layers;
+	std::vector<basic_connection<T>*> connections;
 
-	~neural_net() {
+	/// flat representation. weights are ordered like connections: layer by layer,
+	/// and inside a layer target-major (row j of the matrix holds the incoming weights of neuron j)
+	std::vector<dense_layer> dense;
+	std::vector<T> weights;
+	std::vector<T> biases;
+	std::vector<T> values; // activations of all layers, input layer first
+	std::vector<T> derivs, derivs2;
+	std::vector<int> input_columns; // dataset input feature of every input (copied from input::index)
+
+	basic_neural_net() {}
+	basic_neural_net(const basic_neural_net&) = delete;
+	basic_neural_net& operator=(const basic_neural_net&) = delete;
+
+	~basic_neural_net() {
 		for(size_t i = 0; i != connections.size(); ++i)
 			delete connections[i];
 		connections.clear();
@@ -103,39 +173,202 @@ public:
 	}
 
 	void initialize(std::vector<int> layer_dimensions, rnd* rnd) {
+		if (layer_dimensions.size() <= 1) return; // throw exception, complain, crash the program, etc.
+		build(layer_dimensions);
+		// one draw per perceptron is discarded, so a seed gives the same weights it did when every
+		// perceptron drew a bias first (the biases themselves start at zero)
+		for (size_t j = 0; j != biases.size(); ++j)
+			rnd->next_double();
+		for (auto & w : weights)
+			w = rnd->next_double();
+	}
+
+	/// a new network with the same topology, weights and biases, optionally in another precision
+	template<typename U = T>
+	basic_neural_net<U>* clone() const {
+		auto n = new basic_neural_net<U>;
+		if (dense.empty()) return n;
+		std::vector<int> layer_dimensions(1, dense.front().fan_in);
+		for (auto & l : dense)
+			layer_dimensions.push_back(l.size);
+		n->build(layer_dimensions);
+		n->input_columns = input_columns;
+		for (size_t i = 0; i != dense.size(); ++i)
+			n->dense[i].activation = dense[i].activation;
+		std::copy(weights.begin(), weights.end(), n->weights.begin());
+		std::copy(biases.begin(), biases.end(), n->biases.begin());
+		for (size_t j = 0; j != input_columns.size(); ++j)
+			static_cast<basic_input<U>*>(n->layers[0][j])->index = input_columns[j];
+		return n;
+	}
+
+	void update(dataset_type *d, int row) {
+		if (layers.size() == 0) return;
+		// process inputs
+		auto r = d->row(row);
+		for (size_t j = 0; j != input_columns.size(); ++j) {
+			values[j] = r[input_columns[j]];
+		}
+		// process hidden and output layers
+		for (auto & l : dense) {
+			forward(l);
+		}
+	}
+
+	/// the values of the output layer after the last update()
+	const T* output() const { return &values[dense.back().value_offset]; }
+	int output_size() const { return dense.back().size; }
+
+	/// forward pass over count rows at once. returns the outputs as a (count x output_size()) row-major block
+	/// which stays valid until the workspace is used again
+	const T* update_batch(dataset_type *d, const int *rows, int count, workspace_type& ws) const {
+		return update_batch(d, rows, count, ws, &weights[0]);
+	}
+
+	/// same as above, but reads the weights from w instead of the network's own buffer. w must hold
+	/// weights.size() values in the same order (e.g. a GA genome), and is neither copied nor modified.
+	/// once the workspace has grown to count rows this does not allocate.
+	const T* update_batch(dataset_type *d, const int *rows, int count, workspace_type& ws, const T *w) const {
+		reserve(ws, count);
+		const int nin = input_columns.size();
+		T *x = &ws.values[0];
+		for (int i = 0; i != count; ++i, x += nin) {
+			auto r = d->row(rows[i]);
+			for (int j = 0; j != nin; ++j)
+				x[j] = r[input_columns[j]];
+		}
+		for (auto & l : dense) {
+			T *y = &ws.values[l.value_offset * ws.capacity];
+			gemm_nt(count, l.size, l.fan_in,
+					&ws.values[l.input_offset * ws.capacity], l.fan_in,
+					w + l.weight_offset, l.fan_in,
+					&biases[l.bias_offset],
+					y, l.size);
+			activate(l.activation, y, &ws.derivs[l.value_offset * ws.capacity], nullptr, (size_t)count * l.size);
+		}
+		return &ws.values[dense.back().value_offset * ws.capacity];
+	}
+
+	const T* update_batch(dataset_type *d, const int *rows, int count) {
+		return update_batch(d, rows, count, batch);
+	}
+
+	/// backward pass over the rows of the last update_batch() call on ws. adds the gradient of
+	/// E = 1/2 sum (y - t)^2 over those rows to gw (one value per weight, in the order of weights) and to gb
+	/// (one per bias), and returns the sum of squared errors. every output is compared to the row's target,
+	/// as backprop() does. once the workspace is warm this does not allocate.
+	double backward_batch(dataset_type *d, const int *rows, int count, workspace_type& ws, T *gw, T *gb) const {
+		if (ws.deltas.size() != ws.values.size())
+			ws.deltas.assign(ws.values.size(), T(0));
+		const size_t cap = ws.capacity;
+		const dense_layer& out = dense.back();
+		const T *y = &ws.values[out.value_offset * cap];
+		const T *fd = &ws.derivs[out.value_offset * cap];
+		T *delta = &ws.deltas[out.value_offset * cap];
+		double sse = 0;
+		for (int i = 0; i != count; ++i) {
+			const T t = d->target(rows[i]);
+			for (int j = 0; j != out.size; ++j) {
+				const size_t k = (size_t)i * out.size + j;
+				const T e = y[k] - t;
+				sse += e * e;
+				delta[k] = e * fd[k];
+			}
+		}
+		for (size_t l = dense.size(); l-- != 0;) {
+			const dense_layer& dl = dense[l];
+			delta = &ws.deltas[dl.value_offset * cap];
+			gemm_tn(dl.size, dl.fan_in, count, delta, dl.size, &ws.values[dl.input_offset * cap], dl.fan_in,
+					gw + dl.weight_offset, dl.fan_in);
+			T *b = gb + dl.bias_offset;
+			for (int i = 0; i != count; ++i)
+				for (int j = 0; j != dl.size; ++j)
+					b[j] += delta[(size_t)i * dl.size + j];
+			if (l == 0) break;
+			// deltas of the previous layer: (W^T delta) times the derivative of its activation
+			const dense_layer& prev = dense[l-1];
+			T *pd = &ws.deltas[prev.value_offset * cap];
+			gemm_nn(count, prev.size, dl.size, delta, dl.size, &weights[dl.weight_offset], dl.fan_in, pd, prev.size);
+			const T *pfd = &ws.derivs[prev.value_offset * cap];
+			for (size_t k = 0; k != (size_t)count * prev.size; ++k)
+				pd[k] *= pfd[k];
+		}
+		return sse;
+	}
+
+	/// evaluate the network on the given rows, block by block. out receives rows.size() x output_size() values
+	void predict(dataset_type *d, const std::vector<int>& rows, std::vector<T>& out) {
+		const int nout = output_size();
+		out.resize(rows.size() * nout);
+		for (size_t i = 0; i < rows.size(); i += batch_size) {
+			int count = std::min(rows.size() - i, (size_t)batch_size);
+			auto y = update_batch(d, &rows[i], count, batch);
+			std::copy(y, y + count * nout, out.begin() + i * nout);
+		}
+	}
+
+	/// evaluate the network on the rows of a chunked dataset, a chunk at a time, and add the first output and the
+	/// target of every row to calc (an rsquared_calculator, scaled_fitness_calculator, ...) in row order
+	template<typename Calculator>
+	void add_outputs(basic_chunk_stream<T>& stream, row_range rows, Calculator& calc) {
+		const int nout = output_size();
+		std::vector<int> index;
+		std::vector<T> y(batch_size);
+		stream.start(rows);
+		while (auto chunk = stream.next()) {
+			const size_t n = chunk->rows();
+			for (size_t i = index.size(); i < n; ++i) index.push_back(i);
+			const T *t = chunk->targets().data;
+			for (size_t i = 0; i < n; i += batch_size) {
+				int count = std::min(n - i, (size_t)batch_size);
+				auto out = update_batch(chunk, &index[i], count, batch);
+				for (int j = 0; j != count; ++j)
+					y[j] = out[j * nout];
+				calc.add(&y[0], t + i, count);
+			}
+		}
+	}
+
+	int batch_size = 256; // number of rows predict() and add_outputs() feed through the network at once
+
+private:
+	template<typename> friend class basic_neural_net;
+
+	/// create the layers, the connections and the flat buffers behind them (all weights are zero)
+	void build(const std::vector<int>& layer_dimensions) {
+		allocate(layer_dimensions);
 		layers.resize(layer_dimensions.size());
-		// populate input layer 
+		// populate input layer
 		auto & input_layer = layers[0];
 		for (int j = 0; j != layer_dimensions[0]; ++j) {
-			auto n = new input;
+			auto n = new basic_input<T>;
 			n->index = j;
+			n->value = &values[j];
 			input_layer.push_back(n);
+			input_columns.push_back(j);
 		}
 
-		// populate hidden and output layers
-		for (size_t i = 1; i != layers.size()-1; ++i) {
+		// populate hidden and output layers. biases start at zero (they are only changed by trainers that learn them)
+		for (size_t i = 1; i != layers.size(); ++i) {
+			auto & dl = dense[i-1];
 			for (int j = 0; j != layer_dimensions[i]; ++j) {
-				auto n = new perceptron;
-				n->bias = rnd->next_double();
+				auto n = new basic_perceptron<T>;
+				n->bias = &biases[dl.bias_offset + j];
+				n->value = &values[dl.value_offset + j];
+				n->d = &derivs[dl.value_offset + j];
+				n->d2 = &derivs2[dl.value_offset + j];
 				layers[i].push_back(n);
 			}
 		}
-		size_t size = layer_dimensions.size();
-		for (int j = 0; j != layer_dimensions[size-1]; ++j) {
-                auto n = new perceptron;
-				n->bias = rnd->next_double();
-				layers[size-1].push_back(n);
-		}
 
 		// add connections between the neurons
-		if (layers.size() <= 1) return; // throw exception, complain, crash the program, etc.
 		for (size_t i = 0; i != layers.size() - 1; ++i) {
-			auto curr = layers[i]; // current layer
-			auto next = layers[i+1]; // next layer
-			for (size_t j = 0; j != next.size(); ++j) { 
-				for (size_t k = 0; k != curr.size(); ++k) { 
-					auto conn = new connection;
-					conn->weight = rnd->next_double();
+			auto & curr = layers[i]; // current layer
+			auto & next = layers[i+1]; // next layer
+			for (size_t j = 0; j != next.size(); ++j) {
+				for (size_t k = 0; k != curr.size(); ++k) {
+					auto conn = new basic_connection<T>;
+					conn->weight = &weights[connections.size()];
 					conn->source = curr[k];
 					conn->target = next[j];
 					curr[k]->connections.push_back(conn);
@@ -146,20 +379,63 @@ public:
 		}
 	}
 
-	void update(dataset *d, int row) {
-		if (layers.size() == 0) return;
-		// process inputs
-		for (auto & n : layers[0]) {
-			auto in = static_cast<input*>(n);
-			in->update_value(d->rows[row][in->index]);
-		}
-		// process hidden neurons
-		for (size_t i = 1; i < layers.size(); ++i) {
-			for (auto & n : layers[i]) {
-				n->update();
-			}
+	/// lay out the flat buffers for the given topology
+	void allocate(const std::vector<int>& layer_dimensions) {
+		size_t nweights = 0, nbiases = 0, nvalues = layer_dimensions[0];
+		dense.clear();
+		for (size_t i = 1; i != layer_dimensions.size(); ++i) {
+			dense_layer l;
+			l.size = layer_dimensions[i];
+			l.fan_in = layer_dimensions[i-1];
+			l.weight_offset = nweights;
+			l.bias_offset = nbiases;
+			l.input_offset = nvalues - l.fan_in;
+			l.value_offset = nvalues;
+			l.activation = lecun_tanh_activation;
+			nweights += l.size * l.fan_in;
+			nbiases += l.size;
+			nvalues += l.size;
+			dense.push_back(l);
 		}
+		weights.assign(nweights, T(0));
+		biases.assign(nbiases, T(0));
+		values.assign(nvalues, T(0));
+		derivs.assign(nvalues, T(0));
+		derivs2.assign(nvalues, T(0));
+	}
+
+	void reserve(workspace_type& ws, int rows) const {
+		if (ws.capacity >= rows && ws.values.size() == values.size() * ws.capacity) return;
+		ws.capacity = std::max(rows, ws.capacity);
+		ws.values.assign(values.size() * ws.capacity, T(0));
+		ws.derivs.assign(values.size() * ws.capacity, T(0));
 	}
 
+	/// applies the activation function in place on n values, storing the derivatives in d and d2 (if not null)
+	static void activate(activation_type a, T *y, T *d, T *d2, size_t n) {
+		if (a == identity_activation) activation::identity(y, d, d2, n);
+		else activation::lecun_tanh(y, d, d2, n);
+	}
+
+	workspace_type batch; // used by the update_batch() and predict() overloads without a workspace
+
+	/// y = f(W x + b) for a single layer, W stored row-major
+	void forward(const dense_layer& l) {
+		const T *w = &weights[l.weight_offset];
+		const T *b = &biases[l.bias_offset];
+		const T *x = &values[l.input_offset];
+		T *y = &values[l.value_offset];
+		T *d = &derivs[l.value_offset];
+		T *d2 = &derivs2[l.value_offset];
+		for (int j = 0; j != l.size; ++j, w += l.fan_in) {
+			T s = b[j];
+			for (int k = 0; k != l.fan_in; ++k)
+				s += w[k] * x[k];
+			y[j] = s;
+		}
+		activate(l.activation, y, d, d2, l.size);
+	}
 };
+
+typedef basic_neural_net<double> neural_net;
 #endif
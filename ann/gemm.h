@@ -0,0 +1,154 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <cstddef>
+#include <algorithm>
+
+/// The kernels are templates on the scalar type (double or float); in float a vector register holds twice
+/// as many values, so the compiler's vectorized inner loops do twice the work per instruction.
+
+/// C = A * B^T + bias, where A is (m x k), B is (n x k) and C is (m x n), all row-major.
+/// This is the shape of a batched layer update: A holds one input vector per row, B is the layer's
+/// weight matrix (one row per neuron) and bias is broadcast along the rows of C.
+/// B is packed, a panel of W columns at a time (W values of T fill 64 bytes, one AVX-512 register), into a
+/// transposed panel of (depth x W) values, zero padded. The innermost 4 x W tile then does 4 W multiply-adds
+/// per row of the panel over contiguous memory with a fixed trip count, which the compiler vectorizes: every
+/// element of C is still summed in order over k, and a float panel covers twice the columns of a double one.
+/// Layers narrower than 4 neurons (typically the output) would mostly multiply padding, so they take plain
+/// dot products, four rows at a time.
+template<typename T>
+inline void gemm_nt(int m, int n, int k,
+		const T *A, size_t lda,
+		const T *B, size_t ldb,
+		const T *bias,
+		T *C, size_t ldc) {
+	const int W = 64 / sizeof(T), kb = 256; // panel width and depth
+	if (n < 4) {
+		int i = 0;
+		for (; i + 4 <= m; i += 4) {
+			const T *a0 = A + i * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+			for (int j = 0; j != n; ++j) {
+				const T *b0 = B + j * ldb;
+				T c0 = bias[j], c1 = bias[j], c2 = bias[j], c3 = bias[j];
+				for (int p = 0; p != k; ++p) {
+					c0 += a0[p] * b0[p]; c1 += a1[p] * b0[p];
+					c2 += a2[p] * b0[p]; c3 += a3[p] * b0[p];
+				}
+				T *c = C + i * ldc + j;
+				c[0] = c0; c[ldc] = c1; c[2 * ldc] = c2; c[3 * ldc] = c3;
+			}
+		}
+		for (; i < m; ++i) {
+			const T *a0 = A + i * lda;
+			for (int j = 0; j != n; ++j) {
+				const T *b0 = B + j * ldb;
+				T s = bias[j];
+				for (int p = 0; p != k; ++p)
+					s += a0[p] * b0[p];
+				C[i * ldc + j] = s;
+			}
+		}
+		return;
+	}
+	alignas(64) T panel[kb * W];
+	for (int j0 = 0; j0 < n; j0 += W) {
+		const int jn = std::min(n - j0, W);
+		for (int p0 = 0; p0 < k; p0 += kb) {
+			const int pn = std::min(k - p0, kb);
+			const bool first = p0 == 0;
+			for (int p = 0; p != pn; ++p)
+				for (int j = 0; j != W; ++j)
+					panel[p * W + j] = j < jn ? B[(j0 + j) * ldb + p0 + p] : T(0);
+			int i = 0;
+			for (; i + 4 <= m; i += 4) {
+				const T *a0 = A + i * lda + p0, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+				T c[4][W] = {};
+				for (int p = 0; p != pn; ++p) {
+					const T x0 = a0[p], x1 = a1[p], x2 = a2[p], x3 = a3[p];
+					const T *b = panel + p * W;
+					for (int j = 0; j != W; ++j) {
+						c[0][j] += x0 * b[j]; c[1][j] += x1 * b[j];
+						c[2][j] += x2 * b[j]; c[3][j] += x3 * b[j];
+					}
+				}
+				for (int r = 0; r != 4; ++r) {
+					T *cr = C + (i + r) * ldc + j0;
+					for (int j = 0; j != jn; ++j)
+						cr[j] = (first ? bias[j0 + j] : cr[j]) + c[r][j];
+				}
+			}
+			// remaining rows
+			for (; i < m; ++i) {
+				const T *a0 = A + i * lda + p0;
+				T c[W] = {};
+				for (int p = 0; p != pn; ++p) {
+					const T x = a0[p], *b = panel + p * W;
+					for (int j = 0; j != W; ++j)
+						c[j] += x * b[j];
+				}
+				T *cr = C + i * ldc + j0;
+				for (int j = 0; j != jn; ++j)
+					cr[j] = (first ? bias[j0 + j] : cr[j]) + c[j];
+			}
+		}
+	}
+}
+
+/// C = A * B, where A is (m x k), B is (k x n) and C is (m x n), all row-major.
+/// Used to propagate deltas back through a layer: (rows x size) deltas times the (size x fan_in) weight matrix.
+/// Four rows of B are combined per pass over a row of C, and the inner loop runs over contiguous memory.
+template<typename T>
+inline void gemm_nn(int m, int n, int k,
+		const T *A, size_t lda,
+		const T *B, size_t ldb,
+		T *C, size_t ldc) {
+	for (int i = 0; i != m; ++i) {
+		const T *a = A + i * lda;
+		T *c = C + i * ldc;
+		std::fill(c, c + n, T(0));
+		int p = 0;
+		for (; p + 4 <= k; p += 4) {
+			const T x0 = a[p], x1 = a[p+1], x2 = a[p+2], x3 = a[p+3];
+			const T *b0 = B + p * ldb, *b1 = b0 + ldb, *b2 = b1 + ldb, *b3 = b2 + ldb;
+			for (int j = 0; j != n; ++j)
+				c[j] += x0 * b0[j] + x1 * b1[j] + x2 * b2[j] + x3 * b3[j];
+		}
+		for (; p != k; ++p) {
+			const T x = a[p], *b = B + p * ldb;
+			for (int j = 0; j != n; ++j)
+				c[j] += x * b[j];
+		}
+	}
+}
+
+/// C += A^T * B, where A is (k x m), B is (k x n) and C is (m x n), all row-major.
+/// This is the weight gradient of a batched layer: (rows x size) deltas against (rows x fan_in) inputs,
+/// summed over the rows. C is the size of a weight matrix, so it stays in cache while the rows stream by.
+template<typename T>
+inline void gemm_tn(int m, int n, int k,
+		const T *A, size_t lda,
+		const T *B, size_t ldb,
+		T *C, size_t ldc) {
+	int p = 0;
+	for (; p + 4 <= k; p += 4) {
+		const T *a0 = A + p * lda, *a1 = a0 + lda, *a2 = a1 + lda, *a3 = a2 + lda;
+		const T *b0 = B + p * ldb, *b1 = b0 + ldb, *b2 = b1 + ldb, *b3 = b2 + ldb;
+		for (int i = 0; i != m; ++i) {
+			const T x0 = a0[i], x1 = a1[i], x2 = a2[i], x3 = a3[i];
+			T *c = C + i * ldc;
+			for (int j = 0; j != n; ++j)
+				c[j] += x0 * b0[j] + x1 * b1[j] + x2 * b2[j] + x3 * b3[j];
+		}
+	}
+	for (; p != k; ++p) {
+		const T *a = A + p * lda, *b = B + p * ldb;
+		for (int i = 0; i != m; ++i) {
+			const T x = a[i];
+			T *c = C + i * ldc;
+			for (int j = 0; j != n; ++j)
+				c[j] += x * b[j];
+		}
+	}
+}
+
+#endif // GEMM_H
@@ -0,0 +1,155 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include "gemm.h"
+#include "activation.h"
+#include "../dataset/mapped_file.h"
+#include "../dataset/normalization.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+
+/// Trained model file (written by write_model() in model.h): a model_header, then one model_layer per
+/// dense layer, the dataset column of every input (int32), and at 64-byte aligned offsets the weights and
+/// biases in the layout of neural_net::weights and neural_net::biases.
+struct model_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layers; // dense layers, the input layer excluded
+	uint32_t inputs;
+	uint32_t normalized; // the dataset was normalized: inputs are normalized, outputs reverted
+	double norm_min, norm_max; // see normalization_params
+	double alpha, beta; // linear scaling of the outputs, alpha + beta y (before the normalization is reverted)
+	uint64_t weights, biases; // number of values
+	uint64_t weights_offset, biases_offset; // in bytes from the start of the file
+
+	static const char* expected_magic() { return "METAMODL"; }
+	static const uint32_t expected_version = 1;
+};
+
+struct model_layer {
+	uint32_t size;
+	uint32_t activation; // activation_type
+};
+
+/// scratch buffers for inference_model::predict(). concurrent callers need one each
+struct inference_workspace {
+	inference_workspace() : capacity(0) {}
+	size_t capacity; // rows the buffers can hold
+	std::vector<double> a, b; // activations of consecutive layers
+};
+
+/**
+ * @brief Standalone inference on a trained model file
+ *
+ * The file is mapped and its weights and biases are used in place, so loading only reads the header and
+ * the layer table, whatever the size of the network. predict() takes raw feature vectors: it applies the
+ * dataset normalization the network was trained with, runs the layers (the same kernels as
+ * neural_net::update_batch()), and returns the linearly scaled outputs in the units of the original target.
+ * Nothing here depends on the dataset or on the training code.
+ */
+class inference_model {
+public:
+	/// throws if the file cannot be mapped or is not a valid model
+	explicit inference_model(const char *filename) : file(new mapped_file(filename)) {
+		if (file->size() < sizeof(model_header)) throw "Malformed model file.";
+		std::memcpy(&header, file->data(), sizeof(header));
+		if (std::memcmp(header.magic, model_header::expected_magic(), sizeof(header.magic)) != 0
+				|| header.version != model_header::expected_version) throw "Malformed model file.";
+		const size_t table = sizeof(model_header) + header.layers * sizeof(model_layer) + header.inputs * sizeof(int32_t);
+		if (header.layers == 0 || header.inputs == 0 || table > file->size()) throw "Malformed model file.";
+		const char *p = file->data() + sizeof(model_header);
+		uint64_t fan_in = header.inputs, weights = 0, biases = 0;
+		layers.resize(header.layers);
+		for (auto & l : layers) {
+			model_layer ml;
+			std::memcpy(&ml, p, sizeof(ml));
+			p += sizeof(ml);
+			if (ml.size == 0 || ml.activation > identity_activation) throw "Malformed model file.";
+			l.size = ml.size;
+			l.fan_in = fan_in;
+			l.activation = ml.activation;
+			l.weight_offset = weights;
+			l.bias_offset = biases;
+			weights += (uint64_t)l.size * l.fan_in;
+			biases += l.size;
+			widest = std::max(widest, (size_t)l.size);
+			fan_in = l.size;
+		}
+		columns.resize(header.inputs);
+		std::memcpy(&columns[0], p, header.inputs * sizeof(int32_t));
+		if (weights != header.weights || biases != header.biases
+				|| header.weights_offset % 8 != 0 || header.biases_offset % 8 != 0
+				|| header.weights_offset < table || header.biases_offset < header.weights_offset + weights * sizeof(double)
+				|| file->size() < header.biases_offset + biases * sizeof(double)) throw "Malformed model file.";
+		w = reinterpret_cast<const double*>(file->data() + header.weights_offset);
+		b = reinterpret_cast<const double*>(file->data() + header.biases_offset);
+		norm.applied = header.normalized != 0;
+		norm.min = header.norm_min;
+		norm.max = header.norm_max;
+		widest = std::max(widest, (size_t)header.inputs);
+	}
+
+	int input_size() const { return header.inputs; }
+	int output_size() const { return layers.back().size; }
+	/// the dataset column each input was read from during training
+	const std::vector<int32_t>& input_columns() const { return columns; }
+	const normalization_params& normalization() const { return norm; }
+	double alpha() const { return header.alpha; }
+	double beta() const { return header.beta; }
+
+	/// predicts rows feature vectors at once. x holds (rows x input_size()) raw values in the order of the
+	/// inputs, out receives (rows x output_size()) values. once the workspace is warm this does not allocate
+	void predict(const double *x, size_t rows, double *out, inference_workspace& ws) const {
+		for (size_t r0 = 0; r0 < rows; r0 += block_rows) {
+			const size_t count = std::min(rows - r0, size_t(block_rows));
+			reserve(ws, count);
+			const int nin = header.inputs;
+			double *in = &ws.a[0], *next = &ws.b[0];
+			for (size_t i = 0; i != count * nin; ++i)
+				in[i] = norm.apply(x[r0 * nin + i]);
+			for (auto & l : layers) {
+				gemm_nt(count, l.size, l.fan_in, in, l.fan_in, w + l.weight_offset, l.fan_in, b + l.bias_offset, next, l.size);
+				if (l.activation == identity_activation) activation::identity(next, nullptr, nullptr, count * l.size);
+				else activation::lecun_tanh(next, nullptr, nullptr, count * l.size);
+				std::swap(in, next);
+			}
+			const size_t nout = count * output_size();
+			for (size_t i = 0; i != nout; ++i)
+				out[r0 * output_size() + i] = norm.revert(header.alpha + header.beta * in[i]);
+		}
+	}
+
+	/// one feature vector, using the model's own workspace (not for concurrent use)
+	void predict(const double *x, double *out) {
+		predict(x, 1, out, ws);
+	}
+
+	static const size_t block_rows = 256; // rows fed through the layers at once
+
+private:
+	struct model_dense_layer {
+		int size, fan_in;
+		uint32_t activation;
+		size_t weight_offset, bias_offset;
+	};
+
+	void reserve(inference_workspace& ws, size_t rows) const {
+		if (ws.capacity >= rows && ws.a.size() >= ws.capacity * widest) return;
+		ws.capacity = std::max(rows, ws.capacity);
+		ws.a.assign(ws.capacity * widest, 0.0);
+		ws.b.assign(ws.capacity * widest, 0.0);
+	}
+
+	std::unique_ptr<mapped_file> file;
+	model_header header;
+	std::vector<model_dense_layer> layers;
+	std::vector<int32_t> columns;
+	normalization_params norm;
+	const double *w, *b; // into the mapping
+	size_t widest = 0; // largest layer, inputs included
+	inference_workspace ws;
+};
+
+#endif // INFERENCE_H
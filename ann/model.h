@@ -0,0 +1,57 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include "ann.h"
+#include "inference.h"
+#include <cstdio>
+#include <string>
+
+/// writes the network, the normalization of the dataset it was trained on and the linear scaling of its outputs
+/// (alpha + beta y, see scaled_fitness_calculator) to a model file for inference_model. like dataset::write_binary
+/// it goes through a temporary file. returns false if the file could not be written.
+/// model files hold doubles: the weights of a float network are widened, which is exact
+template<typename T>
+bool write_model(const char *filename, const basic_neural_net<T>& n, const normalization_params& norm, double alpha = 0, double beta = 1) {
+	if (n.dense.empty()) return false;
+	const std::vector<double> weights(n.weights.begin(), n.weights.end()), biases(n.biases.begin(), n.biases.end());
+	model_header h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, model_header::expected_magic(), sizeof(h.magic));
+	h.version = model_header::expected_version;
+	h.layers = n.dense.size();
+	h.inputs = n.input_columns.size();
+	h.normalized = norm.applied;
+	h.norm_min = norm.min;
+	h.norm_max = norm.max;
+	h.alpha = alpha;
+	h.beta = beta;
+	h.weights = n.weights.size();
+	h.biases = n.biases.size();
+	std::string table; // the layers and the input columns
+	for (auto & l : n.dense) {
+		model_layer ml = { (uint32_t)l.size, (uint32_t)l.activation };
+		table.append(reinterpret_cast<const char*>(&ml), sizeof(ml));
+	}
+	for (int c : n.input_columns) {
+		int32_t c32 = c;
+		table.append(reinterpret_cast<const char*>(&c32), sizeof(c32));
+	}
+	h.weights_offset = (sizeof(h) + table.size() + 63) / 64 * 64;
+	h.biases_offset = (h.weights_offset + h.weights * sizeof(double) + 63) / 64 * 64;
+	const std::string tmp = std::string(filename) + ".tmp";
+	FILE *f = std::fopen(tmp.c_str(), "wb");
+	if (!f) return false;
+	const char pad[64] = {};
+	const size_t pad1 = h.weights_offset - sizeof(h) - table.size(), pad2 = h.biases_offset - h.weights_offset - h.weights * sizeof(double);
+	bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+		&& std::fwrite(table.data(), 1, table.size(), f) == table.size()
+		&& std::fwrite(pad, 1, pad1, f) == pad1
+		&& std::fwrite(weights.data(), sizeof(double), h.weights, f) == h.weights
+		&& std::fwrite(pad, 1, pad2, f) == pad2
+		&& std::fwrite(biases.data(), sizeof(double), h.biases, f) == h.biases;
+	ok = std::fclose(f) == 0 && ok;
+	if (!ok || std::rename(tmp.c_str(), filename) != 0) { std::remove(tmp.c_str()); return false; }
+	return true;
+}
+
+#endif // MODEL_H
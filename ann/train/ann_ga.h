@@ -0,0 +1,239 @@
+#ifndef ANN_GA_H
+#define ANN_GA_H
+
+#include "train.h"
+#include "../../ga/engine.h"
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+/// The GA operators and evaluators on network weights that ga_train (ga_train.cpp) runs. They are kept apart so
+/// that they can be measured on their own (see meta_bench)
+
+/// the genome is the network's weights, in the layout of neural_net::weights and in its precision
+template<typename T>
+using ann_genome = std::vector<T>;
+
+/// shared by an evaluator and its clones during a racing run (see racing_options)
+struct race_state {
+	racing_options options;
+	size_t first_stage = 0; // rows in the first stage
+	double threshold = -std::numeric_limits<double>::infinity(); // only changed between generations
+	std::atomic<size_t> rows_evaluated{0};
+	std::atomic<size_t> rows_total{0}; // what evaluating everything on all the rows would have cost
+	std::atomic<size_t> evaluations{0};
+	std::atomic<size_t> stopped{0}; // evaluations stopped before the last row
+};
+
+/// upper confidence bound of the R2 over all the rows, given the R2 of m of them drawn at random:
+/// Fisher's z of R is about normal with a standard error of 1/sqrt(m-3)
+inline double rsquared_bound(double r2, size_t m, double confidence) {
+	if (m <= 3)
+		return 1;
+	const double r = std::min(std::sqrt(r2), 1 - 1e-12);
+	const double upper = std::tanh(std::atanh(r) + confidence / std::sqrt(m - 3.0));
+	return upper * upper;
+}
+
+/// T is the precision of the network, the dataset and the genome. the R2 is accumulated in double
+template<typename T>
+class ann_eval {
+	public:
+		ann_eval() : race(nullptr) {
+			r2calc = std::unique_ptr<rsquared_calculator>(new rsquared_calculator);
+		}
+		/// an evaluator for use on another thread. it shares the (read-only) network and
+		/// dataset, and only owns its scratch buffers
+		ann_eval* clone() const {
+			auto e = new ann_eval;
+			e->n = n;
+			e->d = d;
+			e->indices = indices;
+			e->r = r;
+			e->race = race;
+			return e;
+		}
+		/// the rows to evaluate on. their targets are gathered again by the next evaluation
+		void set_indices(const std::vector<int>& rows) {
+			indices = rows;
+			targets.clear();
+		}
+
+		/// the forward pass reads the weights straight from the genome, and the outputs go
+		/// into the R2 calculator block by block (against the targets, gathered on the first call
+		/// after set_indices()). after that call nothing is allocated.
+		/// when racing, the rows are added stage by stage until the bound of the R2 falls below the threshold
+		double operator()(const ann_genome<T>& genome) {
+			assert(genome.size() == n->weights.size());
+			const size_t rows = indices.size();
+			if (targets.size() != rows) {
+				targets.resize(rows);
+				for (size_t i = 0; i != rows; ++i)
+					targets[i] = d->target(indices[i]);
+			}
+			r2calc->reset();
+			size_t done = 0, stage = race ? race->first_stage : rows;
+			for (;;) {
+				const size_t end = std::min(stage, rows);
+				add_rows(&genome[0], done, end);
+				done = end;
+				if (done == rows || rsquared_bound(r2calc->rsquared(), done, race->options.confidence) < race->threshold)
+					break;
+				stage *= 2;
+			}
+			if (race) {
+				race->rows_evaluated += done;
+				race->rows_total += rows;
+				++race->evaluations;
+				if (done != rows) ++race->stopped;
+			}
+			return r2calc->rsquared();
+		}
+
+		std::unique_ptr<rsquared_calculator> r2calc;
+		basic_batch_workspace<T> ws;
+		const basic_neural_net<T> *n;
+		basic_dataset<T> *d;
+		std::vector<T> outputs; // first output of every row, for networks with several outputs
+		rnd *r;
+		race_state *race; // racing evaluation if set
+
+	private:
+		std::vector<int> indices;
+		std::vector<T> targets; // target of every row in indices, empty until the next evaluation after set_indices()
+
+		/// adds the rows of indices[begin, end) to the R2 calculator
+		void add_rows(const T *w, size_t begin, size_t end) {
+			const int nout = n->output_size();
+			for (size_t i = begin; i < end; i += n->batch_size) {
+				int count = std::min(end - i, (size_t)n->batch_size);
+				auto y = n->update_batch(d, &indices[i], count, ws, w);
+				if (nout != 1) {
+					outputs.resize(count);
+					for (int j = 0; j != count; ++j)
+						outputs[j] = y[j * nout];
+					y = &outputs[0];
+				}
+				r2calc->add(&targets[i], y, count);
+			}
+		}
+};
+
+template<typename T>
+class ann_creator {
+	public:
+		void operator()(ann_genome<T>& genome) {
+			genome.resize(rsize);
+			r->fill_uniform(&genome[0], rsize, -5, 5);
+		}
+
+		int rsize;
+		rnd *r;
+};
+
+template<typename T>
+class ann_crossover {
+	public:
+		void operator()(ann_genome<T>& a, ann_genome<T>& b) {
+			std::swap_ranges(a.begin(), a.begin() + a.size() / 2, b.begin());
+		}
+		rnd *r;
+};
+
+template<typename T>
+class ann_mutation {
+	public:
+		void operator()(ann_genome<T>& a) {
+			int i = r->next(a.size()-1);
+			a[i] = r->next_double();
+		}
+		rnd *r;
+};
+
+/// fitness of a whole generation in one pass over a chunked dataset: each chunk is read once (the next one being
+/// read meanwhile, see basic_chunk_stream) and fed through every genome, so the rows come off the disk once per
+/// generation whatever the population size, and only two chunks are ever in memory. The R2 of a genome is
+/// accumulated over the chunks in row order, in blocks of batch_size rows like ann_eval, so chunks of a multiple of
+/// batch_size rows give the same fitness as ann_eval on all the rows
+template<typename T>
+class ann_stream_eval {
+	public:
+		ann_stream_eval() : n(nullptr), d(nullptr), rows(), r(nullptr) {}
+		/// the engine makes clones for its workers, but evaluate_all() spreads a generation over the workers itself
+		ann_stream_eval* clone() const {
+			auto e = new ann_stream_eval;
+			e->n = n;
+			e->d = d;
+			e->rows = rows;
+			e->r = r;
+			return e;
+		}
+		/// one genome, in a pass of its own
+		double operator()(const ann_genome<T>& genome) {
+			worker_pool pool(1);
+			const std::vector<const ann_genome<T>*> genomes(1, &genome);
+			double fitness;
+			evaluate_all(pool, genomes, &fitness);
+			return fitness;
+		}
+		/// writes the R2 of every genome to fitness, the genomes of a chunk being split over the pool
+		void evaluate_all(worker_pool& pool, const std::vector<const ann_genome<T>*>& genomes, double *fitness) {
+			if (!stream) stream.reset(new basic_chunk_stream<T>(*d));
+			const size_t count = genomes.size();
+			const int nout = n->output_size();
+			calcs.resize(std::max(calcs.size(), count));
+			for (size_t g = 0; g != count; ++g)
+				calcs[g].reset();
+			workspaces.resize(pool.size());
+			outputs.resize(pool.size());
+			stream->start(rows);
+			while (auto chunk = stream->next()) {
+				const size_t m = chunk->rows();
+				for (size_t i = index.size(); i < m; ++i) index.push_back(i);
+				const T *t = chunk->targets().data;
+				pool.run(count, [&](int worker, size_t begin, size_t end) {
+					auto & ws = workspaces[worker];
+					auto & out = outputs[worker];
+					for (size_t g = begin; g != end; ++g) {
+						assert(genomes[g]->size() == n->weights.size());
+						for (size_t i = 0; i < m; i += n->batch_size) {
+							int c = std::min(m - i, (size_t)n->batch_size);
+							auto y = n->update_batch(chunk, &index[i], c, ws, &(*genomes[g])[0]);
+							if (nout != 1) {
+								out.resize(c);
+								for (int j = 0; j != c; ++j)
+									out[j] = y[j * nout];
+								y = &out[0];
+							}
+							calcs[g].add(t + i, y, c);
+						}
+					}
+				});
+			}
+			for (size_t g = 0; g != count; ++g)
+				fitness[g] = calcs[g].rsquared();
+		}
+
+		const basic_neural_net<T> *n;
+		basic_chunked_dataset<T> *d;
+		row_range rows;
+		rnd *r;
+
+	private:
+		std::unique_ptr<basic_chunk_stream<T>> stream; // started by the first evaluation
+		std::vector<rsquared_calculator> calcs; // one per genome of the generation
+		std::vector<basic_batch_workspace<T>> workspaces; // one per worker
+		std::vector<std::vector<T>> outputs; // first outputs, for networks with several outputs, per worker
+		std::vector<int> index; // 0, 1, ... the rows of a chunk
+};
+
+template<typename T>
+struct evaluator_traits<ann_stream_eval<T>> {
+	static const bool batched = true;
+	static void evaluate_all(ann_stream_eval<T>& e, worker_pool& pool, const std::vector<const ann_genome<T>*>& genomes, double *fitness) {
+		e.evaluate_all(pool, genomes, fitness);
+	}
+};
+
+#endif // ANN_GA_H
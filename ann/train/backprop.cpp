@@ -3,11 +3,11 @@
 /// classic backpropagation, http://home.agh.edu.pl/~vlsi/AI/backp_t_en/backprop.html
 /// the ann must be updated first (call ann->update() before calling backprop())
 void backprop(neural_net *ann, double learning_rate, dataset *d, int row) {
-    double target_value = d->rows[row].back();
+    double target_value = d->target(row);
     auto & layers = ann->layers;
     auto & output_layer = layers.back();
     for (auto & n : output_layer) {
-        n->delta = target_value - n->value;
+        n->delta = target_value - *n->value;
 //        std::cout << "Delta: " << n->delta << std::endl;
     }
     // first pass updating deltas of hidden neurons
@@ -17,7 +17,7 @@ void backprop(neural_net *ann, double learning_rate, dataset *d, int row) {
             n->delta = 0;
             for (auto conn : n->connections) {
                 if (conn->target == n) continue; // skip input connections
-                n->delta += conn->weight * conn->target->delta;
+                n->delta += *conn->weight * conn->target->delta;
             }
         }
     }
@@ -29,7 +29,7 @@ void backprop(neural_net *ann, double learning_rate, dataset *d, int row) {
             for (auto conn : n->connections) {
                 if (conn->target == n) continue; // skip input connections
                 auto target = static_cast<neuron*>(conn->target);
-                conn->weight += learning_rate * n->value * target->delta * target->deriv();
+                *conn->weight += learning_rate * *n->value * target->delta * target->deriv();
             }
         }
     }
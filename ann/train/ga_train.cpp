@@ -1,104 +1,129 @@
-#include "train.h"
-#include "../../ga/ga.h"
-#include <memory>
+#include "ann_ga.h"
+#include "../../ga/island.h"
 
-class ann_ind : public ga_individual {
-	public:
-		ann_ind(std::vector<double>& _real) : real(_real) {}
-
-		ga_individual* clone() {
-			return new ann_ind(this->real);
-		}
-		std::vector<double> real;
-};
-
-class ann_eval : public op_base<double, ga_individual*>{
-	public:
-		ann_eval() {
-			r2calc = std::unique_ptr<rsquared_calculator>(new rsquared_calculator);
-		}
-		double operator()(ga_individual* ind) {
-			auto individual = static_cast<ann_ind*>(ind);
-			std::vector<double> weights;
-			// save old connections weights
-			for (auto conn : n->connections) {
-				weights.push_back(conn->weight);
-			}
-			// update connection weights
-			for (int i = 0; i != weights.size(); ++i) {
-				n->connections[i]->weight = individual->real[i];
-			}
-			std::vector<double> targets, outputs;
-			for(auto i : indices) {
-				n->update(d, i);
-				targets.push_back(d->rows[i].back());
-				outputs.push_back(n->layers.back()[0]->value);
-			}
-			// restore connection weights
-			for (int i = 0; i != weights.size(); ++i) {
-				n->connections[i]->weight = weights[i];
-			}
-			r2calc->reset();
-			return r2calc->calculate(targets, outputs);
-		}
+/// the GA run shared by the in-memory and the streamed ga_train. race is the racing state the evaluator was set up
+/// with, null without racing
+template<typename T, typename Evaluator>
+static void run_ga(basic_neural_net<T> *ann, rnd *r, Evaluator *evaluator, int generations, int popsize, int threads,
+		ga_observer *observer, race_state *race, const checkpoint_options& checkpoint) {
+	typedef ga_engine<ann_genome<T>, Evaluator, ann_creator<T>, ann_crossover<T>, ann_mutation<T>> optimizer_type;
+	auto creator = std::unique_ptr<ann_creator<T>>(new ann_creator<T>);
+	creator->rsize = ann->connections.size();
+	auto crossover = std::unique_ptr<ann_crossover<T>>(new ann_crossover<T>);
+	auto mutation = std::unique_ptr<ann_mutation<T>>(new ann_mutation<T>);
+	auto optimizer = std::unique_ptr<optimizer_type>(new optimizer_type(popsize));
+	optimizer->eval = evaluator;
+	optimizer->create = creator.get();
+	optimizer->crossoverOp = crossover.get();
+	optimizer->mutateOp = mutation.get();
+	optimizer->set_random(r);
+	optimizer->mutation_probability = 0.25;
+	optimizer->threads = threads > 0 ? threads : worker_pool::hardware_threads();
+	optimizer->observer = observer;
+	// racing fitnesses depend on the threshold of their generation, so they are not cached
+	optimizer->fitness_cache_size = race ? 0 : 4 * popsize;
+	optimizer->checkpoint_path = checkpoint.path;
+	optimizer->checkpoint_interval = checkpoint.interval;
+	optimizer->genome_length = ann->weights.size(); // a checkpoint of another network is not resumed
 
-		std::unique_ptr<rsquared_calculator> r2calc;
-		neural_net *n;
-		dataset *d;
-		std::vector<int> indices;
-};
+	std::vector<ann_genome<T>> seeds;
+	if (!checkpoint.warm_start.empty()) {
+		if (!optimizer_type::load_genomes(checkpoint.warm_start, seeds)) throw "Could not read the warm start checkpoint.";
+		size_t count = std::min(seeds.size(), (size_t)popsize);
+		if (checkpoint.warm_start_count > 0) count = std::min(count, (size_t)checkpoint.warm_start_count);
+		seeds.resize(count);
+		for (auto & g : seeds)
+			if (g.size() != ann->weights.size()) throw "The warm start checkpoint does not match the network.";
+	}
 
-class ann_creator : public op_base<ann_ind*> {
-	public:
-		ann_ind* operator()() {
-			std::vector<double> v;
-			for (int i = 0; i != rsize; ++i)
-				v.push_back(r->next_double(-5, 5));
-			return new ann_ind(v);	
+	std::cout << "--- Start" << std::endl;
+	if (!checkpoint.path.empty() && checkpoint.resume && optimizer->load_checkpoint(checkpoint.path))
+		std::cout << "--- Resumed from " << checkpoint.path << " at generation " << optimizer->generations() << std::endl;
+	else
+		optimizer->initialize(seeds); // with racing, the initial population is evaluated on all the rows
+	if (!race) {
+		optimizer->evolve(std::max(0, generations - optimizer->generations()));
+	} else {
+		for (int g = optimizer->generations(); g < generations; ++g) {
+			auto & pop = optimizer->population(); // sorted descending
+			const double q = std::min(1.0, std::max(0.0, race->options.quantile));
+			race->threshold = pop[(size_t)(q * (pop.size() - 1) + 0.5)]->fitness;
+			optimizer->evolve(1);
 		}
-		
-		int rsize;
-};
+		if (race->rows_total)
+			std::cout << "--- Racing: " << 100.0 * (1 - (double)race->rows_evaluated / race->rows_total) << "% of the row evaluations saved, "
+				<< race->stopped << " of " << race->evaluations << " evaluations stopped early" << std::endl;
+	}
+	if (!optimizer->flush_checkpoints())
+		std::cout << "Error writing checkpoint " << checkpoint.path << std::endl;
+	auto & best = optimizer->best()->genome;
+	std::copy(best.begin(), best.end(), ann->weights.begin());
+}
 
-class ann_crossover : public op_base<void, ga_individual*, ga_individual*> {
-	public:
-		void operator()(ga_individual* a, ga_individual* b) {
-			auto aa = static_cast<ann_ind*>(a);
-			auto bb = static_cast<ann_ind*>(b);
-			for (int i = 0; i != aa->real.size() / 2; ++i) {
-				std::swap(aa->real[i], bb->real[i]);
-			}
-		}
-};
+template<typename T>
+void ga_train(basic_neural_net<T> *ann, rnd *r, basic_dataset<T> *d, std::vector<int>& indices, int generations, int popsize, int threads,
+		ga_observer *observer, const racing_options& racing, const checkpoint_options& checkpoint) {
+	ann_eval<T> evaluator;
+	evaluator.n = ann;
+	evaluator.d = d;
+	race_state race;
+	if (racing.enabled) {
+		// the stages are prefixes of the rows, so they are put in a random order once for the run
+		race.options = racing;
+		std::vector<int> rows(indices);
+		for (size_t i = rows.size(); i > 1; --i)
+			std::swap(rows[i - 1], rows[r->next(i - 1)]);
+		race.first_stage = std::min(rows.size(), std::max<size_t>(racing.min_rows, std::ceil(racing.first_fraction * rows.size())));
+		evaluator.set_indices(rows);
+		evaluator.race = &race; // before initialize(), which clones the evaluator
+	} else {
+		evaluator.set_indices(indices);
+	}
+	run_ga(ann, r, &evaluator, generations, popsize, threads, observer, racing.enabled ? &race : nullptr, checkpoint);
+}
 
-class ann_mutation : public op_base<void, ga_individual*> {
-	public:
-		void operator()(ga_individual* a) {
-			auto aa = static_cast<ann_ind*>(a);
-			int i = r->next(aa->real.size()-1);
-			aa->real[i] = r->next_double();
-		}
-};
+template<typename T>
+void ga_train(basic_neural_net<T> *ann, rnd *r, basic_chunked_dataset<T> *d, row_range rows, int generations, int popsize,
+		int threads, ga_observer *observer, const checkpoint_options& checkpoint) {
+	ann_stream_eval<T> evaluator;
+	evaluator.n = ann;
+	evaluator.d = d;
+	evaluator.rows = rows;
+	run_ga(ann, r, &evaluator, generations, popsize, threads, observer, nullptr, checkpoint);
+}
 
-void ga_train(neural_net *ann, rnd *r, dataset *d, std::vector<int>& indices, int generations, int popsize) {
-	auto creator = new ann_creator;
-	creator->rsize = ann->connections.size();
-	auto evaluator = new ann_eval;
-	evaluator->n = ann;
-	evaluator->d = d;
-	evaluator->indices = indices; 
-	auto crossover = new ann_crossover;
-	auto mutation = new ann_mutation;
-	auto optimizer = new ga_optimizer<ann_eval, ann_creator, ann_crossover, ann_mutation>(popsize);
-	optimizer->eval = evaluator;
-	optimizer->create = creator;
-	optimizer->crossoverOp = crossover;
-	optimizer->mutateOp = mutation;
-	optimizer->set_random(r);
-	optimizer->mutation_probability = 0.25;
-	optimizer->start(generations);
-	auto best = static_cast<ann_ind*>(optimizer->best());
-	for (int i = 0; i != best->real.size(); ++i) {
-		ann->connections[i]->weight = best->real[i];
-	}
+template<typename T>
+void ga_island_train(basic_neural_net<T> *ann, rnd *r, basic_dataset<T> *d, std::vector<int>& indices, int generations, int islands,
+		int island_size, int migration_interval, int threads) {
+	ann_creator<T> creator;
+	creator.rsize = ann->connections.size();
+	ann_eval<T> evaluator;
+	evaluator.n = ann;
+	evaluator.d = d;
+	evaluator.set_indices(indices);
+	ann_crossover<T> crossover;
+	ann_mutation<T> mutation;
+	island_optimizer<ann_genome<T>, ann_eval<T>, ann_creator<T>, ann_crossover<T>, ann_mutation<T>> optimizer(islands, island_size);
+	optimizer.eval = &evaluator;
+	optimizer.create = &creator;
+	optimizer.crossoverOp = &crossover;
+	optimizer.mutateOp = &mutation;
+	optimizer.set_random(r);
+	optimizer.mutation_probability = 0.25;
+	optimizer.migration_interval = migration_interval;
+	optimizer.threads = threads > 0 ? threads : worker_pool::hardware_threads();
+	optimizer.start(generations);
+	auto & best = optimizer.best()->genome;
+	std::copy(best.begin(), best.end(), ann->weights.begin());
 }
+
+// the double and float versions declared in train.h
+template void ga_train(neural_net*, rnd*, dataset*, std::vector<int>&, int, int, int, ga_observer*, const racing_options&,
+		const checkpoint_options&);
+template void ga_train(basic_neural_net<float>*, rnd*, basic_dataset<float>*, std::vector<int>&, int, int, int, ga_observer*,
+		const racing_options&, const checkpoint_options&);
+template void ga_train(neural_net*, rnd*, chunked_dataset*, row_range, int, int, int, ga_observer*, const checkpoint_options&);
+template void ga_train(basic_neural_net<float>*, rnd*, basic_chunked_dataset<float>*, row_range, int, int, int, ga_observer*,
+		const checkpoint_options&);
+template void ga_island_train(neural_net*, rnd*, dataset*, std::vector<int>&, int, int, int, int, int);
+template void ga_island_train(basic_neural_net<float>*, rnd*, basic_dataset<float>*, std::vector<int>&, int, int, int, int, int);
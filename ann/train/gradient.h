@@ -0,0 +1,106 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include "../ann.h"
+#include "../../parallel/worker_pool.h"
+#include <vector>
+#include <algorithm>
+
+/// Gradient of the sum of squared errors of a network over a set of rows, spread over a pool of threads.
+/// The rows are split into partitions, each partition's gradient is accumulated in its own buffer by
+/// forward and backward passes of up to neural_net::batch_size rows, and the buffers are then summed in
+/// partition order. The number of partitions only depends on the number of rows, so the result does
+/// not depend on the number of threads. Buffers are kept between calls.
+class batch_gradient {
+public:
+	batch_gradient(const neural_net *n, int threads) : n(n), pool(threads < 1 ? 1 : threads), workspaces(pool.size()) {}
+
+	/// number of values in a gradient: the weights, followed by the biases
+	size_t size() const { return n->weights.size() + n->biases.size(); }
+
+	/// writes the gradient of E = 1/2 sum (y - t)^2 over the given rows into g (size() values)
+	/// and returns the sum of squared errors
+	double operator()(dataset *d, const int *rows, size_t count, double *g) {
+		const size_t p = size(), nw = n->weights.size();
+		const size_t parts = std::max<size_t>(1, std::min<size_t>(max_partitions, (count + min_rows - 1) / min_rows));
+		partials.resize(parts * p);
+		errors.resize(parts);
+		pool.run(parts, [&](int worker, size_t begin, size_t end) {
+			auto & ws = workspaces[worker];
+			for (size_t k = begin; k != end; ++k) {
+				double *pg = &partials[k * p];
+				std::fill(pg, pg + p, 0.0);
+				errors[k] = 0;
+				const size_t r0 = count * k / parts, r1 = count * (k + 1) / parts;
+				for (size_t i = r0; i < r1; i += n->batch_size) {
+					int c = std::min(r1 - i, (size_t)n->batch_size);
+					n->update_batch(d, rows + i, c, ws);
+					errors[k] += n->backward_batch(d, rows + i, c, ws, pg, pg + nw);
+				}
+			}
+		});
+		// reduction, split over the parameters
+		pool.run(p, [&](int, size_t begin, size_t end) {
+			std::copy(&partials[begin], &partials[end], g + begin);
+			for (size_t k = 1; k != parts; ++k) {
+				const double *pg = &partials[k * p];
+				for (size_t i = begin; i != end; ++i)
+					g[i] += pg[i];
+			}
+		});
+		double sse = 0;
+		for (auto e : errors) sse += e;
+		return sse;
+	}
+
+	/// the same over the rows of a chunked dataset, a chunk at a time: the gradients of the chunks are summed
+	/// in row order. a single chunk gives the same result as the whole dataset in memory
+	double operator()(chunk_stream& stream, row_range rows, double *g) {
+		const size_t p = size();
+		std::fill(g, g + p, 0.0);
+		chunk_gradient.resize(p);
+		double sse = 0;
+		stream.start(rows);
+		while (auto chunk = stream.next()) {
+			while (index.size() < chunk->rows()) index.push_back(index.size());
+			sse += (*this)(chunk, &index[0], chunk->rows(), &chunk_gradient[0]);
+			for (size_t i = 0; i != p; ++i)
+				g[i] += chunk_gradient[i];
+		}
+		return sse;
+	}
+
+	static const int min_rows = 64; // smallest partition worth a task of its own
+	static const int max_partitions = 64;
+
+private:
+	const neural_net *n;
+	worker_pool pool;
+	std::vector<batch_workspace> workspaces; // one per worker
+	std::vector<double> partials; // one gradient per partition
+	std::vector<double> errors; // sum of squared errors per partition
+	std::vector<double> chunk_gradient; // of the current chunk, when streaming
+	std::vector<int> index; // 0, 1, ... the rows of a chunk
+};
+
+/// R2 of the network's first output against the targets of the given rows
+inline double rsquared(neural_net *ann, dataset *d, const std::vector<int>& rows) {
+	std::vector<double> out, y(rows.size()), t(rows.size());
+	ann->predict(d, rows, out);
+	for (size_t i = 0; i != rows.size(); ++i) {
+		y[i] = out[i * ann->output_size()];
+		t[i] = d->target(rows[i]);
+	}
+	rsquared_calculator r2calc;
+	r2calc.add(&y[0], &t[0], rows.size());
+	return r2calc.rsquared();
+}
+
+/// the same on the rows of a chunked dataset, streamed
+inline double rsquared(neural_net *ann, chunk_stream& stream, row_range rows) {
+	rsquared_calculator r2calc;
+	ann->add_outputs(stream, rows, r2calc);
+	return r2calc.rsquared();
+}
+
+#endif // GRADIENT_H
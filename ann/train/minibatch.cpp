@@ -0,0 +1,110 @@
+#include "train.h"
+#include "gradient.h"
+#include <chrono>
+#include <cmath>
+
+double learning_rate_at(const minibatch_options& options, int epoch) {
+	switch (options.schedule) {
+		case step_decay:
+			return options.learning_rate * std::pow(options.decay, epoch / std::max(1, options.decay_epochs));
+		case exponential_decay:
+			return options.learning_rate * std::pow(options.decay, (double)epoch / std::max(1, options.decay_epochs));
+		case inverse_time_decay:
+			return options.learning_rate / (1 + options.decay * epoch);
+		default:
+			return options.learning_rate;
+	}
+}
+
+/// one gradient step per batch of rows (the first count of order), along the mean gradient of the batch.
+/// returns the sum of squared errors
+static double minibatch_steps(neural_net *ann, batch_gradient& gradient, dataset *d, const std::vector<int>& order, size_t count,
+		size_t batch, double rate, std::vector<double>& g) {
+	const size_t nw = ann->weights.size(), nb = ann->biases.size();
+	double sse = 0;
+	for (size_t i = 0; i < count; i += batch) {
+		const size_t n = std::min(batch, count - i);
+		sse += gradient(d, &order[i], n, &g[0]);
+		const double step = rate / n;
+		for (size_t k = 0; k != nw; ++k)
+			ann->weights[k] -= step * g[k];
+		for (size_t k = 0; k != nb; ++k)
+			ann->biases[k] -= step * g[nw + k];
+	}
+	return sse;
+}
+
+/// shuffles the first n values of order
+static void shuffle(rnd *r, std::vector<int>& order, size_t n) {
+	for (size_t i = n - 1; i > 0; --i)
+		std::swap(order[i], order[r->next(i)]);
+}
+
+/// the epochs, epoch(rate) being one pass over the rows that returns their sum of squared errors.
+/// fills in everything but the R2
+template<typename Epoch>
+static training_report minibatch_epochs(size_t rows, Epoch epoch_pass, const minibatch_options& options) {
+	training_report report;
+	auto t0 = std::chrono::steady_clock::now();
+	for (int epoch = 0; epoch != options.epochs; ++epoch) {
+		const double rate = learning_rate_at(options, epoch);
+		report.mse = epoch_pass(rate) / rows;
+		if (options.verbose)
+			std::cout << "--- Epoch " << epoch << ", learning rate " << rate << ", MSE " << report.mse << std::endl;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	report.epochs = options.epochs;
+	report.seconds = std::chrono::duration<double>(t1 - t0).count();
+	report.epochs_per_second = report.seconds > 0 ? report.epochs / report.seconds : 0;
+	return report;
+}
+
+static void print_report(const training_report& report) {
+	std::cout << "--- Mini-batch training: " << report.epochs << " epochs, " << report.epochs_per_second
+		<< " epochs/s, R2 " << report.rsquared << std::endl;
+}
+
+training_report minibatch_train(neural_net *ann, rnd *r, dataset *d, std::vector<int>& indices, const minibatch_options& options) {
+	training_report report;
+	if (indices.empty()) return report;
+	const int threads = options.threads > 0 ? options.threads : worker_pool::hardware_threads();
+	batch_gradient gradient(ann, threads);
+	std::vector<double> g(gradient.size());
+	std::vector<int> order(indices);
+	const size_t batch = std::max(1, options.batch_size);
+	report = minibatch_epochs(order.size(), [&](double rate) {
+		if (options.shuffle) shuffle(r, order, order.size());
+		return minibatch_steps(ann, gradient, d, order, order.size(), batch, rate, g);
+	}, options);
+	report.rsquared = rsquared(ann, d, indices);
+	print_report(report);
+	return report;
+}
+
+training_report minibatch_train(neural_net *ann, rnd *r, chunked_dataset *d, row_range rows, const minibatch_options& options) {
+	training_report report;
+	rows = d->clip(rows);
+	if (rows.size() == 0) return report;
+	const int threads = options.threads > 0 ? options.threads : worker_pool::hardware_threads();
+	batch_gradient gradient(ann, threads);
+	std::vector<double> g(gradient.size());
+	std::vector<int> order;
+	const size_t batch = std::max(1, options.batch_size);
+	chunk_stream stream(*d);
+	report = minibatch_epochs(rows.size(), [&](double rate) {
+		double sse = 0;
+		stream.start(rows);
+		while (auto chunk = stream.next()) {
+			const size_t n = chunk->rows();
+			order.resize(n);
+			for (size_t i = 0; i != n; ++i) order[i] = i;
+			if (options.shuffle) shuffle(r, order, n);
+			sse += minibatch_steps(ann, gradient, chunk, order, n, batch, rate, g);
+		}
+		return sse;
+	}, options);
+	report.rsquared = rsquared(ann, stream, rows);
+	print_report(report);
+	return report;
+}
@@ -0,0 +1,90 @@
+#include "train.h"
+#include "gradient.h"
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+/// one iRprop+ step on n parameters (Igel & Huesken, "Improving the Rprop learning algorithm", 2000)
+static void irprop_step(double *w, size_t n, const double *g, double *prev, double *step, double *change,
+		bool worse, const rprop_options& options) {
+	for (size_t k = 0; k != n; ++k) {
+		const double s = prev[k] * g[k];
+		if (s < 0) {
+			// the gradient changed sign: we jumped over a minimum
+			step[k] = std::max(step[k] * options.decrease, options.min_step);
+			if (worse) w[k] -= change[k]; // revert the last change, but only if the error went up
+			change[k] = 0;
+			prev[k] = 0; // no adaptation at the next step
+			continue;
+		}
+		if (s > 0)
+			step[k] = std::min(step[k] * options.increase, options.max_step);
+		change[k] = g[k] > 0 ? -step[k] : g[k] < 0 ? step[k] : 0;
+		w[k] += change[k];
+		prev[k] = g[k];
+	}
+}
+
+/// the iRprop+ epochs. pass(g) is one pass over the rows: it writes their gradient to g and returns their sum of
+/// squared errors. fills in everything but the R2
+template<typename Pass>
+static training_report rprop_epochs(neural_net *ann, size_t rows, size_t p, Pass pass, const rprop_options& options) {
+	training_report report;
+	const size_t nw = ann->weights.size(), nb = ann->biases.size();
+	std::vector<double> g(p), prev(p, 0.0), step(p, options.initial_step), change(p, 0.0);
+	double prev_error = std::numeric_limits<double>::infinity();
+
+	auto t0 = std::chrono::steady_clock::now();
+	int epoch = 0;
+	for (; epoch != options.epochs; ++epoch) {
+		// one pass over all the rows gives the error of the current weights and its gradient
+		const double error = pass(&g[0]);
+		report.mse = error / rows;
+		if (options.verbose)
+			std::cout << "--- Epoch " << epoch << ", MSE " << report.mse << std::endl;
+		if (report.mse <= options.target_mse) break;
+		const bool worse = error > prev_error;
+		irprop_step(&ann->weights[0], nw, &g[0], &prev[0], &step[0], &change[0], worse, options);
+		irprop_step(&ann->biases[0], nb, &g[nw], &prev[nw], &step[nw], &change[nw], worse, options);
+		prev_error = error;
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	report.epochs = epoch;
+	report.seconds = std::chrono::duration<double>(t1 - t0).count();
+	report.epochs_per_second = report.seconds > 0 ? report.epochs / report.seconds : 0;
+	return report;
+}
+
+static void print_report(const training_report& report) {
+	std::cout << "--- RPROP training: " << report.epochs << " epochs, " << report.epochs_per_second
+		<< " epochs/s, R2 " << report.rsquared << std::endl;
+}
+
+training_report rprop(neural_net *ann, dataset *d, std::vector<int>& indices, const rprop_options& options) {
+	training_report report;
+	if (indices.empty()) return report;
+	const int threads = options.threads > 0 ? options.threads : worker_pool::hardware_threads();
+	batch_gradient gradient(ann, threads);
+	report = rprop_epochs(ann, indices.size(), gradient.size(), [&](double *g) {
+		return gradient(d, &indices[0], indices.size(), g);
+	}, options);
+	report.rsquared = rsquared(ann, d, indices);
+	print_report(report);
+	return report;
+}
+
+training_report rprop(neural_net *ann, chunked_dataset *d, row_range rows, const rprop_options& options) {
+	training_report report;
+	rows = d->clip(rows);
+	if (rows.size() == 0) return report;
+	const int threads = options.threads > 0 ? options.threads : worker_pool::hardware_threads();
+	batch_gradient gradient(ann, threads);
+	chunk_stream stream(*d);
+	report = rprop_epochs(ann, rows.size(), gradient.size(), [&](double *g) {
+		return gradient(stream, rows, g);
+	}, options);
+	report.rsquared = rsquared(ann, stream, rows);
+	print_report(report);
+	return report;
+}
@@ -2,9 +2,109 @@
 #define TRAIN_H
 
 #include "../ann.h"
+#include <string>
+
+class ga_observer;
 
 void backprop(neural_net *ann, double learning_rate, dataset *d, int row);
-void rprop(neural_net *ann, double learning_rate, dataset *d, int row); // to be implemented
-void ga_train(neural_net *ann, rnd *r, dataset *d, std::vector<int>& indices, int generations, int popsize);
+
+/// summary of a gradient training run
+struct training_report {
+	int epochs = 0;
+	double seconds = 0;
+	double epochs_per_second = 0;
+	double mse = 0; // mean squared error over the last epoch, measured while it ran
+	double rsquared = 0; // on the training rows, after training
+};
+
+enum learning_rate_schedule {
+	constant_rate, // learning_rate
+	step_decay, // learning_rate * decay^floor(epoch / decay_epochs)
+	exponential_decay, // learning_rate * decay^(epoch / decay_epochs)
+	inverse_time_decay // learning_rate / (1 + decay * epoch)
+};
+
+struct minibatch_options {
+	int epochs = 100;
+	int batch_size = 256; // rows per gradient step
+	double learning_rate = 0.01;
+	learning_rate_schedule schedule = constant_rate;
+	double decay = 0.5;
+	int decay_epochs = 10;
+	bool shuffle = true; // visit the rows in a new random order every epoch
+	int threads = 0; // threads sharing every batch, 0 for all hardware threads
+	bool verbose = false; // print the MSE of every epoch
+};
+
+double learning_rate_at(const minibatch_options& options, int epoch);
+/// mini-batch gradient descent on the squared error, learning weights and biases. every batch is split over
+/// the threads (see batch_gradient), so the result does not depend on the thread count
+training_report minibatch_train(neural_net *ann, rnd *r, dataset *d, std::vector<int>& indices, const minibatch_options& options);
+/// the same on the rows of a chunked dataset, read a chunk at a time (see chunked_dataset.h): every epoch visits the
+/// chunks in order and, with options.shuffle, the rows of each chunk in a new random order. batches do not span chunks
+training_report minibatch_train(neural_net *ann, rnd *r, chunked_dataset *d, row_range rows, const minibatch_options& options);
+
+struct rprop_options {
+	int epochs = 500;
+	double initial_step = 0.1;
+	double min_step = 1e-6;
+	double max_step = 50;
+	double increase = 1.2; // step factor while the gradient keeps its sign
+	double decrease = 0.5; // step factor when it changes sign
+	double target_mse = 0; // stop as soon as the mean squared error is this low
+	int threads = 0; // threads sharing every epoch, 0 for all hardware threads
+	bool verbose = false; // print the MSE of every epoch
+};
+
+/// full-batch iRprop+: every weight and bias has its own step size, adapted to the sign of its gradient over
+/// all the rows. every epoch is one batched pass over the rows (see batch_gradient), whatever the thread count
+training_report rprop(neural_net *ann, dataset *d, std::vector<int>& indices, const rprop_options& options);
+/// the same on the rows of a chunked dataset: every epoch is one pass over the file, a chunk at a time
+training_report rprop(neural_net *ann, chunked_dataset *d, row_range rows, const rprop_options& options);
+
+/// racing evaluation for ga_train: an offspring is evaluated on a growing prefix of the training rows (in a random
+/// order fixed for the run), doubling at every stage, and is stopped as soon as an upper confidence bound of its R2
+/// falls below the fitness of the parent population at the given quantile. A stopped offspring keeps the R2 of the
+/// rows it was evaluated on; every offspring above the threshold is evaluated on all the rows.
+struct racing_options {
+	bool enabled = false;
+	double first_fraction = 1.0 / 16; // share of the rows in the first stage
+	int min_rows = 256; // smallest first stage
+	double quantile = 0.5; // 0 races against the best parent, 1 against the worst
+	double confidence = 3; // width of the bound, in standard errors of Fisher's z of R
+};
+
+/// checkpointing for ga_train (see ga/checkpoint.h). a run killed part way can be started again with the same
+/// arguments and continues from its last checkpoint; without racing it ends exactly as an uninterrupted run would
+struct checkpoint_options {
+	std::string path; // checkpoint file, none if empty
+	int interval = 10; // generations between checkpoints
+	bool resume = true; // continue from path if it holds a checkpoint of a population of the same size, network and precision
+	std::string warm_start; // checkpoint of a previous run, whose best individuals start the population
+	int warm_start_count = 0; // how many of them, 0 for as many as fit
+};
+
+/// threads: number of threads evaluating the population, 0 uses all hardware threads.
+/// observer: receives per-generation telemetry (see ga/telemetry.h), none if null.
+/// racing: see racing_options, the share of row evaluations saved is printed at the end
+/// generations counts the generations done before a resumed checkpoint
+/// T is double or float: in float the genomes, the forward passes and the dataset are single precision, the R2 is
+/// still accumulated in double
+template<typename T>
+void ga_train(basic_neural_net<T> *ann, rnd *r, basic_dataset<T> *d, std::vector<int>& indices, int generations, int popsize,
+		int threads = 0, ga_observer *observer = nullptr, const racing_options& racing = racing_options(),
+		const checkpoint_options& checkpoint = checkpoint_options());
+/// the same on the rows of a chunked dataset, read a chunk at a time: every generation is one pass over the file, each
+/// chunk going through all the offspring before the next one is used (see ann_stream_eval). there is no racing, as
+/// its stages are random subsets of the rows. with chunks of a multiple of ann->batch_size rows, the run is the one
+/// the in-memory ga_train makes on the same rows
+template<typename T>
+void ga_train(basic_neural_net<T> *ann, rnd *r, basic_chunked_dataset<T> *d, row_range rows, int generations, int popsize,
+		int threads = 0, ga_observer *observer = nullptr, const checkpoint_options& checkpoint = checkpoint_options());
+/// island model: islands populations of island_size individuals, exchanging their best individual every
+/// migration_interval generations (ring topology). threads: islands evolved concurrently, 0 for all hardware threads
+template<typename T>
+void ga_island_train(basic_neural_net<T> *ann, rnd *r, basic_dataset<T> *d, std::vector<int>& indices, int generations, int islands,
+		int island_size, int migration_interval = 10, int threads = 0);
 
 #endif // TRAIN_H
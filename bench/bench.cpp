@@ -0,0 +1,388 @@
+// Microbenchmarks of the hot paths. Every benchmark prints one JSON object per line:
+//   {"benchmark": name, "params": ..., "calls": n, "ns_per_op": t, "ops_per_second": r, "allocs_per_op": a [, "mb_per_second": b]}
+// where an op is a row for the network benchmarks and ann_eval, a generation for the GA, a row for loading and
+// for the chunked passes, a value for normalize and the random generators, and a pair for the statistics
+// calculators. Inputs are generated from fixed seeds. ann_eval must not allocate once warm: if it does, meta_bench
+// says so on stderr and exits with 1. lecun_tanh_accuracy prints the largest error of activation::lecun_tanh
+// instead of timings, and fails the same way when it is above the documented bound.
+//
+// usage: meta_bench [filter [min_seconds]]   (only runs the benchmarks whose name contains filter)
+#include "../ann/ann.h"
+#include "../ann/model.h"
+#include "../ann/train/train.h"
+#include "../ann/train/ann_ga.h"
+#include "ga_ops.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <string>
+
+// every allocation of the process goes through these, so allocations per op can be reported
+static std::atomic<size_t> allocations(0);
+
+// the replacements below allocate and free through these. they are kept out of line so that the compiler does not
+// see free() called on the result of an operator new (-Wmismatched-new-delete)
+__attribute__((noinline)) static void* counted_alloc(size_t n) noexcept {
+    ++allocations;
+    return std::malloc(n ? n : 1);
+}
+__attribute__((noinline)) static void counted_free(void *p) noexcept { std::free(p); }
+
+void* operator new(size_t n) {
+    if (void *p = counted_alloc(n)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t n) {
+    if (void *p = counted_alloc(n)) return p;
+    throw std::bad_alloc();
+}
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n); }
+void operator delete(void *p) noexcept { counted_free(p); }
+void operator delete[](void *p) noexcept { counted_free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void *p, size_t) noexcept { counted_free(p); }
+void operator delete[](void *p, size_t) noexcept { counted_free(p); }
+
+static std::string filter;
+static double min_seconds = 0.5;
+static bool failed = false; // a benchmark broke one of its guarantees, meta_bench exits with 1
+
+/// calls f until min_seconds have passed (after one warm-up call) and prints the result.
+/// ops: number of ops done by one call, bytes: number of bytes processed by one call (for a throughput).
+/// returns the allocations per op
+template<class F>
+double measure(const std::string& name, const std::string& params, double ops, F f, double bytes = 0) {
+    f();
+    const size_t a0 = allocations;
+    size_t calls = 0;
+    double seconds = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    do {
+        f();
+        ++calls;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    } while (seconds < min_seconds);
+    const double total = ops * calls;
+    const double allocs = (allocations - a0) / total;
+    std::printf("{\"benchmark\": \"%s\", \"params\": \"%s\", \"calls\": %zu, \"ns_per_op\": %.3f, \"ops_per_second\": %.1f, \"allocs_per_op\": %.4f",
+            name.c_str(), params.c_str(), calls, seconds * 1e9 / total, total / seconds, allocs);
+    if (bytes > 0)
+        std::printf(", \"mb_per_second\": %.1f", bytes * calls / seconds / 1e6);
+    std::printf("}\n");
+    std::fflush(stdout);
+    return allocs;
+}
+
+static bool enabled(const char *name) {
+    return std::string(name).find(filter) != std::string::npos;
+}
+
+static std::string join(const std::vector<int>& v) {
+    std::ostringstream s;
+    for (size_t i = 0; i != v.size(); ++i) s << (i ? "-" : "") << v[i];
+    return s.str();
+}
+
+/// rows x (inputs + 1) uniform values in [-1, 1], the last column being the target
+static dataset random_dataset(rnd *r, size_t rows, int inputs) {
+    std::vector<std::vector<double>> table(rows, std::vector<double>(inputs + 1));
+    for (auto & row : table)
+        for (auto & v : row) v = r->next_double(-1, 1);
+    return dataset(table);
+}
+
+static void bench_network() {
+    const std::vector<std::vector<int>> topologies = { {3, 5, 1}, {16, 32, 1}, {64, 64, 64, 1}, {256, 256, 1} };
+    const int block = 256;
+    for (auto & topology : topologies) {
+        rnd r;
+        r.seed(42);
+        dataset d = random_dataset(&r, block, topology.front());
+        neural_net n;
+        n.initialize(topology, &r);
+        std::vector<int> rows(block);
+        for (int i = 0; i != block; ++i) rows[i] = i;
+        const std::string params = join(topology);
+
+        if (enabled("ann_update"))
+            measure("ann_update", params, block, [&]() {
+                for (int i = 0; i != block; ++i) n.update(&d, i);
+            });
+        batch_workspace ws;
+        if (enabled("ann_update_batch"))
+            measure("ann_update_batch", params, block, [&]() {
+                n.update_batch(&d, &rows[0], block, ws);
+            });
+        if (enabled("ann_update_batch_f32")) {
+            basic_dataset<float> fd(d);
+            std::unique_ptr<basic_neural_net<float>> fn(n.clone<float>());
+            basic_batch_workspace<float> fws;
+            measure("ann_update_batch_f32", params, block, [&]() {
+                fn->update_batch(&fd, &rows[0], block, fws);
+            });
+        }
+        if (enabled("ann_eval")) {
+            // a GA fitness evaluation, which reads the weights from the genome and must not allocate once warm
+            ann_eval<double> e;
+            e.n = &n;
+            e.d = &d;
+            e.set_indices(rows);
+            const ann_genome<double> genome(n.weights);
+            double fitness = 0;
+            if (measure("ann_eval", params, block, [&]() { fitness += e(genome); }) != 0) {
+                std::fprintf(stderr, "ann_eval allocates after warm-up (%s)\n", params.c_str());
+                failed = true;
+            }
+            if (fitness == 42) std::printf("\n");
+        }
+        if (enabled("backprop"))
+            measure("backprop", params, block, [&]() {
+                for (int i = 0; i != block; ++i) {
+                    n.update(&d, i);
+                    backprop(&n, 1e-6, &d, i);
+                }
+            });
+        std::vector<double> gw(n.weights.size()), gb(n.biases.size());
+        if (enabled("backward_batch"))
+            measure("backward_batch", params, block, [&]() {
+                n.update_batch(&d, &rows[0], block, ws);
+                n.backward_batch(&d, &rows[0], block, ws, &gw[0], &gb[0]);
+            });
+        if (enabled("inference_predict")) {
+            const char *file = "meta_bench.tmp.model";
+            write_model(file, n, normalization_params());
+            inference_model m(file);
+            std::vector<double> x(block * m.input_size()), y(block * m.output_size());
+            for (int i = 0; i != block; ++i)
+                std::copy(d.row(i), d.row(i) + m.input_size(), &x[i * m.input_size()]);
+            inference_workspace iws;
+            measure("inference_predict", params, block, [&]() { m.predict(&x[0], block, &y[0], iws); });
+            std::remove(file);
+        }
+    }
+}
+
+/// largest error of activation::lecun_tanh in precision T against 1.7159 tanh(2/3 x) in double, over points evenly
+/// spread on [-60, 60]
+template<typename T>
+static void check_lecun_tanh(const char *precision, double bound) {
+    const size_t n = 1 << 22;
+    std::vector<T> x(n);
+    for (size_t i = 0; i != n; ++i) x[i] = T(-60 + 120.0 * i / (n - 1));
+    std::vector<T> y(x);
+    T *none = nullptr;
+    activation::lecun_tanh(&y[0], none, none, n);
+    double abs_error = 0, ulp_error = 0;
+    for (size_t i = 0; i != n; ++i) {
+        const double reference = activation::lecun_b * std::tanh(activation::lecun_c * x[i]);
+        const double e = std::fabs(y[i] - reference);
+        const T r = T(reference);
+        const double ulp = std::fabs((double)std::nextafter(r, std::numeric_limits<T>::infinity()) - r);
+        abs_error = std::max(abs_error, e);
+        ulp_error = std::max(ulp_error, e / ulp);
+    }
+    std::printf("{\"benchmark\": \"lecun_tanh_accuracy\", \"params\": \"%s [-60, 60]\", \"points\": %zu, \"max_abs_error\": %.3g, "
+            "\"max_ulp_error\": %.2f, \"bound\": %.3g}\n", precision, n, abs_error, ulp_error, bound);
+    std::fflush(stdout);
+    if (abs_error > bound) {
+        std::fprintf(stderr, "lecun_tanh (%s) is above its error bound\n", precision);
+        failed = true;
+    }
+}
+
+static void bench_activation() {
+    if (!enabled("lecun_tanh_accuracy")) return;
+    check_lecun_tanh<double>("double", activation::lecun_tanh_error);
+    check_lecun_tanh<float>("float", activation::lecun_tanhf_error);
+}
+
+static void bench_ga() {
+    const int genome_size = 16;
+    for (int popsize : { 100, 1000, 10000 }) {
+        const std::string params = "popsize=" + std::to_string(popsize) + " genome=" + std::to_string(genome_size);
+        if (enabled("ga_optimizer_generation")) {
+            rnd r;
+            r.seed(42);
+            vec_creator c; c.size = genome_size;
+            vec_eval e;
+            vec_crossover x;
+            vec_mutation m;
+            ga_optimizer<vec_eval, vec_creator, vec_crossover, vec_mutation> opt(popsize);
+            opt.create = &c; opt.eval = &e; opt.crossoverOp = &x; opt.mutateOp = &m;
+            opt.set_random(&r);
+            opt.mutation_probability = 0.25;
+            opt.initialize();
+            measure("ga_optimizer_generation", params, 1, [&]() { opt.evolve(1); });
+        }
+        if (enabled("ga_engine_generation")) {
+            rnd r;
+            r.seed(42);
+            static_creator c; c.size = genome_size;
+            static_eval e;
+            static_crossover x;
+            static_mutation m;
+            ga_engine<genome, static_eval, static_creator, static_crossover, static_mutation> opt(popsize);
+            opt.create = &c; opt.eval = &e; opt.crossoverOp = &x; opt.mutateOp = &m;
+            opt.set_random(&r);
+            opt.mutation_probability = 0.25;
+            opt.initialize();
+            measure("ga_engine_generation", params, 1, [&]() { opt.evolve(1); });
+        }
+    }
+}
+
+static void bench_dataset() {
+    const size_t rows = 200000;
+    const int columns = 8;
+    const char *text = "meta_bench.tmp.txt", *binary = "meta_bench.tmp.bin";
+    const std::string params = std::to_string(rows) + "x" + std::to_string(columns);
+    {
+        rnd r;
+        r.seed(42);
+        std::ofstream out(text);
+        out.precision(17);
+        for (size_t i = 0; i != rows; ++i)
+            for (int j = 0; j != columns; ++j)
+                out << r.next_double(-1000, 1000) << (j + 1 == columns ? '\n' : ' ');
+    }
+    std::ifstream in(text, std::ios::binary | std::ios::ate);
+    const double bytes = in.tellg();
+
+    if (enabled("dataset_load_text"))
+        measure("dataset_load_text", params, rows, [&]() { dataset d(text); }, bytes);
+    // the same file through the line-by-line stream reader (getline and split_string), to compare against
+    if (enabled("dataset_load_text_getline"))
+        measure("dataset_load_text_getline", params, rows, [&]() {
+            std::ifstream file(text);
+            dataset d(file, load_options());
+        }, bytes);
+    dataset d(text);
+    d.write_binary(binary);
+    if (enabled("dataset_load_binary"))
+        measure("dataset_load_binary", params, rows, [&]() { dataset b; b.read_binary(binary); });
+    {
+        // a pass over the rows of the binary file a chunk at a time, with the next chunk read ahead
+        chunked_dataset c(binary, 1 << 14);
+        chunk_stream stream(c);
+        double sink = 0;
+        const std::string chunked = params + "/" + std::to_string(c.chunk_rows());
+        if (enabled("dataset_chunked_pass"))
+            measure("dataset_chunked_pass", chunked, rows, [&]() {
+                stream.start(c.all());
+                while (auto chunk = stream.next()) sink += chunk->target(0);
+            }, rows * columns * sizeof(double));
+        if (enabled("dataset_chunked_rsquared")) {
+            rnd r;
+            r.seed(42);
+            neural_net n;
+            n.initialize({columns - 1, 16, 1}, &r);
+            rsquared_calculator r2;
+            measure("dataset_chunked_rsquared", chunked + "/" + join({columns - 1, 16, 1}), rows, [&]() {
+                r2.reset();
+                n.add_outputs(stream, c.all(), r2);
+                sink += r2.rsquared();
+            }, rows * columns * sizeof(double));
+        }
+        if (sink == 42) std::printf("\n");
+    }
+    if (enabled("dataset_normalize"))
+        measure("dataset_normalize", params, rows * columns, [&]() { d.normalize(); });
+    std::remove(text);
+    std::remove(binary);
+}
+
+static void bench_statistics() {
+    const size_t n = 1 << 20;
+    rnd r;
+    r.seed(42);
+    std::vector<double> x(n), y(n);
+    for (size_t i = 0; i != n; ++i) {
+        x[i] = r.next_double(-1, 1);
+        y[i] = 0.5 * x[i] + r.next_double(-0.1, 0.1);
+    }
+    const std::string params = "n=" + std::to_string(n);
+    double sink = 0;
+    if (enabled("rsquared_calculator")) {
+        rsquared_calculator c;
+        measure("rsquared_calculator", params, n, [&]() {
+            c.reset();
+            for (size_t i = 0; i != n; ++i) c.add(x[i], y[i]);
+            sink += c.rsquared();
+        });
+    }
+    if (enabled("rsquared_calculator_bulk")) {
+        rsquared_calculator c;
+        measure("rsquared_calculator_bulk", params, n, [&]() {
+            c.reset();
+            c.add(&x[0], &y[0], n);
+            sink += c.rsquared();
+        });
+    }
+    if (enabled("lsp_calculator")) {
+        lsp_calculator c;
+        measure("lsp_calculator", params, n, [&]() {
+            c.reset();
+            for (size_t i = 0; i != n; ++i) c.add(x[i], y[i]);
+            sink += c.Alpha() + c.Beta();
+        });
+    }
+    if (enabled("scaled_fitness_calculator")) {
+        scaled_fitness_calculator c;
+        measure("scaled_fitness_calculator", params, n, [&]() {
+            c.reset();
+            c.add(&x[0], &y[0], n);
+            sink += c.result().mse;
+        });
+    }
+    if (enabled("mv_calculator")) {
+        mv_calculator c;
+        measure("mv_calculator", params, n, [&]() {
+            c.reset();
+            for (size_t i = 0; i != n; ++i) c.add(x[i]);
+            sink += c.variance();
+        });
+    }
+    if (sink == 42) std::printf("\n"); // keeps the results alive
+}
+
+static void bench_random() {
+    const size_t n = 1 << 16;
+    rnd r;
+    r.seed(42);
+    std::vector<double> v(n);
+    double sink = 0;
+    if (enabled("rnd_next_double"))
+        measure("rnd_next_double", "", n, [&]() {
+            for (size_t i = 0; i != n; ++i) v[i] = r.next_double(-5, 5);
+        });
+    if (enabled("rnd_next_int"))
+        measure("rnd_next_int", "", n, [&]() {
+            for (size_t i = 0; i != n; ++i) v[i] = r.next(99);
+        });
+    if (enabled("rnd_fill_uniform"))
+        measure("rnd_fill_uniform", "", n, [&]() { r.fill_uniform(&v[0], n, -5, 5); });
+    if (enabled("rnd_fill_normal"))
+        measure("rnd_fill_normal", "", n, [&]() { r.fill_normal(&v[0], n); });
+    for (auto x : v) sink += x;
+    if (sink == 42) std::printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) filter = argv[1];
+    if (argc > 2) min_seconds = std::atof(argv[2]);
+    bench_network();
+    bench_activation();
+    bench_ga();
+    bench_dataset();
+    bench_statistics();
+    bench_random();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+// Per-generation cost of the GA machinery with a cheap fitness function: ga_optimizer (virtual operators,
+// heap allocated ga_individual) against ga_engine (value genomes, operators inlined into the loop).
+// Both runs use the same seed and consume the same random numbers, so they must end with the same best fitness.
+#include "ga_ops.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/// best of a few runs from the same seed, in microseconds per generation
+template<class Optimizer>
+double run(Optimizer& opt, rnd& r, unsigned seed, int generations, double& best) {
+    double t = 0;
+    for (int rep = 0; rep != 5; ++rep) {
+        r.seed(seed);
+        opt.initialize();
+        auto t0 = std::chrono::steady_clock::now();
+        opt.evolve(generations);
+        auto t1 = std::chrono::steady_clock::now();
+        double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / generations;
+        if (rep == 0 || us < t) t = us;
+    }
+    best = opt.best()->fitness;
+    return t;
+}
+
+int main(int argc, char **argv) {
+    const int popsize = argc > 1 ? std::atoi(argv[1]) : 1000;
+    const int size = argc > 2 ? std::atoi(argv[2]) : 16;
+    const int generations = argc > 3 ? std::atoi(argv[3]) : 200;
+    const unsigned seed = 12345;
+
+    rnd r1;
+    vec_creator c1; c1.size = size;
+    vec_eval e1;
+    vec_crossover x1;
+    vec_mutation m1;
+    ga_optimizer<vec_eval, vec_creator, vec_crossover, vec_mutation> poly(popsize);
+    poly.create = &c1; poly.eval = &e1; poly.crossoverOp = &x1; poly.mutateOp = &m1;
+    poly.set_random(&r1);
+    poly.mutation_probability = 0.25;
+
+    rnd r2;
+    static_creator c2; c2.size = size;
+    static_eval e2;
+    static_crossover x2;
+    static_mutation m2;
+    ga_engine<genome, static_eval, static_creator, static_crossover, static_mutation> engine(popsize);
+    engine.create = &c2; engine.eval = &e2; engine.crossoverOp = &x2; engine.mutateOp = &m2;
+    engine.set_random(&r2);
+    engine.mutation_probability = 0.25;
+
+    double best_poly, best_static;
+    double us_poly = run(poly, r1, seed, generations, best_poly);
+    double us_static = run(engine, r2, seed, generations, best_static);
+
+    std::printf("popsize %d genome %d generations %d\n", popsize, size, generations);
+    std::printf("polymorphic_us_per_generation %.2f\n", us_poly);
+    std::printf("static_us_per_generation %.2f\n", us_static);
+    std::printf("speedup %.2f\n", us_poly / us_static);
+    std::printf("same_result %d\n", best_poly == best_static ? 1 : 0);
+    return best_poly == best_static ? 0 : 1;
+}
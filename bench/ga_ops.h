@@ -0,0 +1,94 @@
+#ifndef GA_OPS_H
+#define GA_OPS_H
+
+// A cheap fitness function (the sphere, in (0, 1] with its maximum at the origin) and the same genetic
+// operators written twice: against the polymorphic interface for ga_optimizer, and as plain function
+// objects for ga_engine. Both versions consume the same random numbers, so for a given seed the two
+// optimizers produce the same population.
+#include "../ga/ga.h"
+
+typedef std::vector<double> genome;
+
+/// fitness in (0, 1], 1 at the origin
+inline double sphere(const double *x, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i != n; ++i) s += x[i] * x[i];
+    return 1 / (1 + s);
+}
+
+// polymorphic operators
+class vec_ind : public ga_individual {
+public:
+    ga_individual* clone() { auto c = new vec_ind; c->x = x; c->fitness = fitness; return c; }
+    void copy_from(const ga_individual& other) {
+        auto & o = static_cast<const vec_ind&>(other);
+        x.assign(o.x.begin(), o.x.end());
+        fitness = o.fitness;
+    }
+    genome x;
+};
+
+class vec_creator : public op_base<vec_ind*> {
+public:
+    vec_ind* operator()() {
+        auto v = new vec_ind;
+        v->x.resize(size);
+        for (auto & x : v->x) x = r->next_double(-5, 5);
+        return v;
+    }
+    int size;
+};
+
+class vec_eval : public op_base<double, ga_individual*> {
+public:
+    vec_eval* clone() const { return new vec_eval(*this); }
+    double operator()(ga_individual* ind) {
+        auto & x = static_cast<vec_ind*>(ind)->x;
+        return sphere(&x[0], x.size());
+    }
+};
+
+class vec_crossover : public op_base<void, ga_individual*, ga_individual*> {
+public:
+    void operator()(ga_individual* a, ga_individual* b) {
+        auto & x = static_cast<vec_ind*>(a)->x;
+        auto & y = static_cast<vec_ind*>(b)->x;
+        std::swap_ranges(x.begin(), x.begin() + x.size() / 2, y.begin());
+    }
+};
+
+class vec_mutation : public op_base<void, ga_individual*> {
+public:
+    void operator()(ga_individual* a) {
+        auto & x = static_cast<vec_ind*>(a)->x;
+        x[r->next(x.size() - 1)] = r->next_double();
+    }
+};
+
+// the same operators for ga_engine
+struct static_creator {
+    void operator()(genome& g) {
+        g.resize(size);
+        for (auto & x : g) x = r->next_double(-5, 5);
+    }
+    int size;
+    rnd *r;
+};
+
+struct static_eval {
+    static_eval* clone() const { return new static_eval(*this); }
+    double operator()(const genome& g) { return sphere(&g[0], g.size()); }
+    rnd *r;
+};
+
+struct static_crossover {
+    void operator()(genome& a, genome& b) { std::swap_ranges(a.begin(), a.begin() + a.size() / 2, b.begin()); }
+    rnd *r;
+};
+
+struct static_mutation {
+    void operator()(genome& g) { g[r->next(g.size() - 1)] = r->next_double(); }
+    rnd *r;
+};
+
+#endif // GA_OPS_H
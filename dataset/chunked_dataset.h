@@ -0,0 +1,316 @@
+#ifndef CHUNKED_DATASET_H
+#define CHUNKED_DATASET_H
+
+#include "dataset.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+
+/// the rows [begin, end) of a dataset
+struct row_range {
+	size_t begin, end;
+	size_t size() const { return end > begin ? end - begin : 0; }
+};
+
+/**
+ * @brief A dataset that stays on disk and is read a chunk of rows at a time
+ *
+ * The values are kept in a binary dataset file (see dataset::write_binary) and read with pread(), chunk_rows()
+ * rows at a time, so the memory used does not depend on the size of the file. A text file is read through its
+ * binary cache (dataset::cache_path), which is converted from the text in a streaming pass when it is missing or
+ * older than the text: the conversion never holds more than a chunk either, and writes the same file
+ * dataset(filename, options) would write with options.cache set.
+ *
+ * Passes over the rows go through a basic_chunk_stream, which reads the next chunk on a background thread while the
+ * current one is being used. Every chunk is a basic_dataset of its own, so everything that works on a dataset
+ * (update_batch(), backward_batch(), backprop()) works on a chunk, with the rows numbered from 0.
+ */
+template<typename T>
+class basic_chunked_dataset {
+public:
+	/// filename is a text file, read through its binary cache whatever options.cache says.
+	/// throws if the text cannot be read or the cache cannot be written
+	basic_chunked_dataset(const char *filename, const load_options& options, size_t chunk_rows = default_chunk_rows)
+			: fd(-1), nchunk(std::max<size_t>(1, chunk_rows)) {
+		const std::string cache = basic_dataset<T>::cache_path(filename);
+		const uint64_t key = basic_dataset<T>::options_key(options);
+		if (!(basic_dataset<T>::newer_or_same(cache.c_str(), filename) && open(cache.c_str(), &key))) {
+			convert(filename, cache.c_str(), options, key);
+			if (!open(cache.c_str(), &key)) throw "Could not read the dataset cache.";
+		}
+	}
+
+	/// a binary file written by dataset::write_binary (whatever its key), or a cache. throws if it is not valid
+	explicit basic_chunked_dataset(const char *binary_filename, size_t chunk_rows = default_chunk_rows)
+			: fd(-1), nchunk(std::max<size_t>(1, chunk_rows)) {
+		if (!open(binary_filename, nullptr)) throw "Malformed data file.";
+	}
+
+	~basic_chunked_dataset() {
+		if (fd >= 0) ::close(fd);
+	}
+
+	basic_chunked_dataset(const basic_chunked_dataset&) = delete;
+	basic_chunked_dataset& operator=(const basic_chunked_dataset&) = delete;
+
+	size_t rows() const { return header.rows; }
+	size_t columns() const { return header.columns; }
+	size_t input_count() const { return header.columns - 1; }
+	int target_column() const { return header.target; }
+	const std::vector<std::string>& column_names() const { return names; }
+	const normalization_params& normalization() const { return norm; }
+	size_t chunk_rows() const { return nchunk; }
+	row_range all() const { row_range r = { 0, rows() }; return r; }
+	/// the rows of r the dataset has
+	row_range clip(row_range r) const {
+		r.end = std::min(r.end, rows());
+		r.begin = std::min(r.begin, r.end);
+		return r;
+	}
+
+	/// reads the rows [first, first + count) into chunk, whose rows are then numbered from 0.
+	/// the chunk's buffer is reused. returns false if the file could not be read. safe to call concurrently
+	bool read(size_t first, size_t count, basic_dataset<T>& chunk) const {
+		const size_t nin = input_count();
+		chunk.reshape(count, header.columns, header.target);
+		chunk.norm = norm;
+		const uint64_t base = header.data_offset;
+		return read_all(chunk.values, count * nin * sizeof(T), base + first * nin * sizeof(T))
+			&& read_all(chunk.values + count * nin, count * sizeof(T), base + (header.rows * nin + first) * sizeof(T));
+	}
+
+	static const size_t default_chunk_rows = 1 << 16;
+
+private:
+	typedef typename basic_dataset<T>::binary_header binary_header;
+
+	/// opens a binary file and checks its header (and its key, if given)
+	bool open(const char *filename, const uint64_t *key) {
+		const int f = ::open(filename, O_RDONLY);
+		if (f < 0) return false;
+		struct stat st;
+		binary_header h;
+		std::vector<char> packed;
+		bool ok = ::fstat(f, &st) == 0 && (size_t)st.st_size >= sizeof(h)
+			&& ::pread(f, &h, sizeof(h), 0) == (ssize_t)sizeof(h)
+			&& basic_dataset<T>::valid_header(h, st.st_size) && (!key || h.key == *key);
+		if (ok) {
+			packed.resize(h.names_size + 1, '\0');
+			ok = h.names_size == 0 || ::pread(f, &packed[0], h.names_size, sizeof(h)) == (ssize_t)h.names_size;
+		}
+		if (!ok) { ::close(f); return false; }
+		if (fd >= 0) ::close(fd);
+		fd = f;
+		header = h;
+		names.clear();
+		basic_dataset<T>::unpack_names(&packed[0], h, names);
+		norm.applied = h.normalized != 0;
+		norm.min = h.norm_min;
+		norm.max = h.norm_max;
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		return true;
+	}
+
+	bool read_all(void *dst, size_t n, uint64_t offset) const {
+		char *p = static_cast<char*>(dst);
+		while (n != 0) {
+			const ssize_t got = ::pread(fd, p, n, offset);
+			if (got < 0 && errno == EINTR) continue;
+			if (got <= 0) return false;
+			p += got; n -= got; offset += got;
+		}
+		return true;
+	}
+
+	static bool write_all(int f, const void *src, size_t n, uint64_t offset) {
+		const char *p = static_cast<const char*>(src);
+		while (n != 0) {
+			const ssize_t put = ::pwrite(f, p, n, offset);
+			if (put < 0 && errno == EINTR) continue;
+			if (put <= 0) return false;
+			p += put; n -= put; offset += put;
+		}
+		return true;
+	}
+
+	/// moves p past up to n rows (non-empty lines), counting them in count
+	static const char* skip_rows(const char *p, const char *end, const delimiter_set& delimiters, size_t n, size_t& count) {
+		count = 0;
+		while (p != end && count != n) {
+			const char *eol = basic_dataset<T>::end_of_line(p, end);
+			for (const char *q = p; q != eol; ++q)
+				if (!delimiters(*q)) { ++count; break; }
+			p = eol == end ? end : eol + 1;
+		}
+		return p;
+	}
+
+	/// writes the binary cache of a text file a chunk at a time: a first pass finds the chunk boundaries (and the
+	/// bounds of the values, if they are normalized), the last one parses every chunk and writes its inputs and
+	/// its targets in place
+	void convert(const char *filename, const char *cache, const load_options& options, uint64_t key) {
+		mapped_file file(filename);
+		const char *begin = file.data(), *end = begin + file.size();
+		const delimiter_set delimiters((options.delimiters + "\r").c_str());
+		basic_dataset<T> shape; // everything but the values
+		if (options.header) begin = basic_dataset<T>::read_names(begin, end, delimiters, shape.names);
+		const size_t columns = basic_dataset<T>::first_columns(begin, end, delimiters);
+		if (columns == 0) throw "Malformed data file.";
+		const int target = options.target < 0 ? columns - 1 : options.target;
+		if ((size_t)target >= columns) throw "Target column out of range.";
+
+		std::vector<const char*> bounds(1, begin);
+		std::vector<size_t> counts;
+		size_t rows = 0;
+		for (const char *p = begin; p != end; ) {
+			size_t n;
+			p = skip_rows(p, end, delimiters, nchunk, n);
+			if (n == 0) break;
+			bounds.push_back(p);
+			counts.push_back(n);
+			rows += n;
+		}
+		basic_dataset<T> chunk;
+		auto parse = [&](size_t k) {
+			chunk.reshape(counts[k], columns, target);
+			if (!chunk.parse_rows(bounds[k], bounds[k + 1], delimiters, 0)) throw "Malformed data file.";
+		};
+		double min = 0, max = 0;
+		if (options.normalize)
+			for (size_t k = 0; k != counts.size(); ++k) {
+				parse(k);
+				chunk.bounds(min, max);
+			}
+
+		shape.nrows = rows;
+		shape.ncols = columns;
+		shape.target_col = target;
+		if (options.normalize) {
+			shape.norm.applied = true;
+			shape.norm.min = min;
+			shape.norm.max = max;
+		}
+		std::string packed;
+		const binary_header h = shape.make_header(key, packed);
+		const std::string tmp = std::string(cache) + ".tmp";
+		const int f = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (f < 0) throw "Could not write the dataset cache.";
+		const size_t nin = columns - 1;
+		const char pad[64] = {};
+		bool ok = write_all(f, &h, sizeof(h), 0) && write_all(f, packed.data(), packed.size(), sizeof(h))
+			&& write_all(f, pad, h.data_offset - sizeof(h) - packed.size(), sizeof(h) + packed.size());
+		for (size_t k = 0, first = 0; ok && k != counts.size(); first += counts[k++]) {
+			parse(k);
+			if (options.normalize) chunk.normalize(min, max);
+			ok = write_all(f, chunk.values, counts[k] * nin * sizeof(T), h.data_offset + first * nin * sizeof(T))
+				&& write_all(f, chunk.values + counts[k] * nin, counts[k] * sizeof(T), h.data_offset + (rows * nin + first) * sizeof(T));
+		}
+		ok = ::close(f) == 0 && ok;
+		if (!ok || std::rename(tmp.c_str(), cache) != 0) {
+			std::remove(tmp.c_str());
+			throw "Could not write the dataset cache.";
+		}
+	}
+
+	int fd;
+	size_t nchunk; // rows per chunk
+	binary_header header;
+	std::vector<std::string> names;
+	normalization_params norm;
+};
+
+typedef basic_chunked_dataset<double> chunked_dataset;
+
+/**
+ * @brief A sequential pass over the rows of a chunked dataset, reading ahead on a background thread
+ *
+ * start() begins a pass over a range of rows and next() hands out its chunks in order. While a chunk is being used,
+ * the next one is read into a second buffer, so reading and computing overlap and at most two chunks are in memory.
+ * A stream can run any number of passes; its thread lives as long as the stream.
+ */
+template<typename T>
+class basic_chunk_stream {
+public:
+	explicit basic_chunk_stream(const basic_chunked_dataset<T>& source)
+			: source(source), range(), nchunks(0), produced(0), consumed(0), busy(false), failed(false), stop(false),
+			thread(&basic_chunk_stream::loop, this) {}
+
+	~basic_chunk_stream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+
+	basic_chunk_stream(const basic_chunk_stream&) = delete;
+	basic_chunk_stream& operator=(const basic_chunk_stream&) = delete;
+
+	/// starts a pass over the rows of r (clipped to the dataset), abandoning the current one. the first chunk is
+	/// read at once
+	void start(row_range r) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this] { return !busy; });
+			range = source.clip(r);
+			nchunks = (range.size() + source.chunk_rows() - 1) / source.chunk_rows();
+			produced = consumed = 0;
+			failed = false;
+		}
+		wake.notify_all();
+	}
+
+	/// the next chunk of the pass, or null at its end. the chunk is the caller's until the next call to next() or
+	/// start(). first, if not null, receives the number of the chunk's first row in the dataset.
+	/// throws if the file could not be read
+	basic_dataset<T>* next(size_t *first = nullptr) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (consumed == nchunks) return nullptr;
+		done.wait(lock, [this] { return produced > consumed; });
+		if (failed) throw "Error reading the data file.";
+		if (first) *first = range.begin + consumed * source.chunk_rows();
+		basic_dataset<T>* chunk = &buffers[consumed % 2];
+		++consumed; // the reader may now fill the other buffer
+		lock.unlock();
+		wake.notify_all();
+		return chunk;
+	}
+
+private:
+	/// reads chunk k as soon as the consumer has taken chunk k - 1, so the buffer of chunk k - 2 is free
+	void loop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock, [this] { return stop || (produced < nchunks && produced == consumed); });
+			if (stop) return;
+			const size_t k = produced;
+			const size_t first = range.begin + k * source.chunk_rows();
+			const size_t count = std::min(source.chunk_rows(), range.end - first);
+			busy = true;
+			lock.unlock();
+			const bool ok = source.read(first, count, buffers[k % 2]);
+			lock.lock();
+			busy = false;
+			failed = failed || !ok;
+			++produced;
+			done.notify_all();
+		}
+	}
+
+	const basic_chunked_dataset<T>& source;
+	basic_dataset<T> buffers[2];
+	row_range range; // of the current pass
+	size_t nchunks; // in the current pass
+	size_t produced, consumed; // chunks of the current pass read by the thread, and handed out by next()
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	bool busy, failed, stop;
+	std::thread thread; // last, so that it starts once the rest is constructed
+};
+
+typedef basic_chunk_stream<double> chunk_stream;
+
+#endif // CHUNKED_DATASET_H
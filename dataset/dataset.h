@@ -6,6 +6,14 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <cstdio>
+#include "mapped_file.h"
+#include "parse.h"
+#include "normalization.h"
+#include "../parallel/worker_pool.h"
 
 namespace {
 struct split {
@@ -34,57 +42,513 @@ std::vector<std::string>& split_string(std::vector<std::string>&             res
     return result;
 }
 
-class dataset {
+/// non-owning view of size values placed stride apart
+template<typename T>
+struct basic_vector_view {
+	const T *data;
+	size_t size;
+	size_t stride;
+	T operator[](size_t i) const { return data[i * stride]; }
+};
+
+/// non-owning view of a (rows x cols) matrix, element (i, j) is data[i * row_stride + j * col_stride]
+template<typename T>
+struct basic_matrix_view {
+	const T *data;
+	size_t rows, cols;
+	size_t row_stride, col_stride;
+	T operator()(size_t i, size_t j) const { return data[i * row_stride + j * col_stride]; }
+	const T* row(size_t i) const { return data + i * row_stride; } // contiguous when col_stride == 1
+	basic_vector_view<T> column(size_t j) const { basic_vector_view<T> v = { data + j * col_stride, rows, row_stride }; return v; }
+};
+
+typedef basic_vector_view<double> vector_view;
+typedef basic_matrix_view<double> matrix_view;
+
+/// options for reading delimited text
+struct load_options {
+	load_options() : delimiters(" \t"), header(false), target(-1), threads(0), normalize(false), cache(false) {}
+	std::string delimiters; // field separators. runs of separators count as one, '\r' is always ignored
+	bool header; // the first line holds the column names
+	int target; // target column, -1 for the last one
+	int threads; // parsing threads, 0 for all hardware threads
+	bool normalize; // call normalize() after loading
+	bool cache; // go through a binary cache next to the text file (see dataset::cache_path)
+};
+
+/// A table of values held in one contiguous buffer. One column is the target (the last one unless told
+/// otherwise), the others are the inputs. The buffer holds the (rows x inputs) input matrix in row-major
+/// order, followed by the target column, so both the feature vector of a row and the target column have
+/// unit stride. Columns are numbered as in the source, the target included.
+///
+/// A dataset can also be stored in a binary file (write_binary/read_binary) holding the shape, the column
+/// names and target, the normalization parameters and the values in exactly this layout. Reading one maps
+/// the file (copy-on-write) and uses the mapped values in place, so nothing is parsed or copied.
+///
+/// The values are doubles (dataset) or floats (basic_dataset<float>), which halves the memory and the
+/// bandwidth a pass over the rows needs. Text is always parsed in double and rounded to T, normalize()
+/// computes in double, and the normalization parameters stay in double.
+template<typename T>
+class basic_dataset {
 	public:
-		dataset() {}
+		basic_dataset() : values(nullptr), nrows(0), ncols(0), target_col(0) {}
+
+		basic_dataset(const basic_dataset& other) : basic_dataset() { *this = other; }
+		/// other is left empty
+		basic_dataset(basic_dataset&& other) : basic_dataset() { *this = std::move(other); }
+		/// the same table in another precision
+		template<typename U>
+		explicit basic_dataset(const basic_dataset<U>& other) : basic_dataset() {
+			storage.assign(other.values, other.values + other.nrows * other.ncols);
+			values = storage.data();
+			names = other.names;
+			norm = other.norm;
+			nrows = other.nrows; ncols = other.ncols; target_col = other.target_col;
+		}
+		basic_dataset& operator=(const basic_dataset& other) {
+			if (this == &other) return *this;
+			storage.assign(other.values, other.values + other.nrows * other.ncols);
+			values = storage.data();
+			mapping.reset();
+			names = other.names;
+			norm = other.norm;
+			nrows = other.nrows; ncols = other.ncols; target_col = other.target_col;
+			return *this;
+		}
+		basic_dataset& operator=(basic_dataset&& other) {
+			storage.swap(other.storage);
+			mapping.swap(other.mapping);
+			std::swap(values, other.values);
+			names.swap(other.names);
+			std::swap(norm, other.norm);
+			std::swap(nrows, other.nrows); std::swap(ncols, other.ncols); std::swap(target_col, other.target_col);
+			return *this;
+		}
 
-		dataset(const char* filename) {
-			std::ifstream ifstr(filename);
-			if (!ifstr.is_open()) { throw "Could not open file."; }
-			rows.clear();
+		/// target: column holding the target values, -1 for the last one
+		basic_dataset(const char* filename, int target = -1) : values(nullptr), nrows(0), ncols(0), target_col(0) {
+			load_options options;
+			options.target = target;
+			load(filename, options);
+		}
+
+		/// The file is memory-mapped and cut into line-aligned chunks which are parsed in parallel,
+		/// straight into the final buffer, without allocating per line or per field.
+		/// With options.cache the binary cache is used instead when it is at least as recent as the
+		/// text file and was made with the same options. Otherwise the text is parsed (and normalized,
+		/// if asked) and the cache is written for the next time.
+		basic_dataset(const char* filename, const load_options& options) : values(nullptr), nrows(0), ncols(0), target_col(0) {
+			if (!options.cache) {
+				load(filename, options);
+				if (options.normalize) normalize();
+				return;
+			}
+			const std::string cache = cache_path(filename);
+			const uint64_t key = options_key(options);
+			if (newer_or_same(cache.c_str(), filename) && read_binary(cache.c_str(), key)) return;
+			load(filename, options);
+			if (options.normalize) normalize();
+			write_binary(cache.c_str(), key);
+		}
+
+		/// reads from a stream line by line (for input that cannot be mapped, like pipes)
+		basic_dataset(std::istream& in, const load_options& options) : values(nullptr), nrows(0), ncols(0), target_col(0) {
+			std::vector<double> table; // row-major, as read
+			size_t columns = 0;
 			std::string line;
-			while (std::getline(ifstr, line)) {
-				std::vector<std::string> fields;
-				split_string(fields, line, " ");
-				std::vector<double> row;
-				for (auto f : fields) {
-					double v = atof(f.c_str());
-					row.push_back(v);
-				}
-				rows.push_back(row);
+			std::vector<std::string> fields;
+			const std::string delimiters = options.delimiters + "\r";
+			if (options.header && std::getline(in, line))
+				split_string(names, line, delimiters, split::no_empties);
+			while (std::getline(in, line)) {
+				split_string(fields, line, delimiters, split::no_empties);
+				if (fields.empty()) continue;
+				if (columns == 0) columns = fields.size();
+				if (fields.size() != columns) { throw "Inconsistent number of columns."; }
+				for (auto & f : fields)
+					table.push_back(atof(f.c_str()));
 			}
+			assign(table, table.size() / std::max<size_t>(columns, 1), columns, options.target);
+			if (options.normalize) normalize();
+		}
+
+		basic_dataset(const std::vector<std::vector<double>>& rows_, int target = -1) : values(nullptr), nrows(0), ncols(0), target_col(0) {
+			std::vector<double> table;
+			for (auto & r : rows_) {
+				if (r.size() != rows_[0].size()) { throw "Inconsistent number of columns."; }
+				table.insert(table.end(), r.begin(), r.end());
+			}
+			assign(table, rows_.size(), rows_.empty() ? 0 : rows_[0].size(), target);
+		}
+
+		size_t rows() const { return nrows; }
+		size_t columns() const { return ncols; }
+		size_t input_count() const { return ncols != 0 ? ncols - 1 : 0; } // 0 for an empty dataset
+		int target_column() const { return target_col; }
+		const std::vector<std::string>& column_names() const { return names; } // empty if there was no header
+		const normalization_params& normalization() const { return norm; }
+
+		/// the input features of row i (input_count() contiguous values)
+		const T* row(size_t i) const { return values + i * (ncols - 1); }
+		T target(size_t i) const { return values[nrows * (ncols - 1) + i]; }
+
+		/// zero-copy views of the input matrix and of the target column
+		basic_matrix_view<T> inputs() const {
+			basic_matrix_view<T> m = { values, nrows, input_count(), input_count(), 1 };
+			return m;
+		}
+		basic_vector_view<T> targets() const {
+			basic_vector_view<T> v = { values + nrows * input_count(), nrows, 1 };
+			return v;
+		}
+
+		/// any column, numbered as in the source
+		basic_vector_view<T> column(size_t j) const {
+			if ((int)j == target_col) return targets();
+			return inputs().column(input_index(j));
+		}
+		T at(size_t i, size_t j) const { return column(j)[i]; }
+
+		/// makes another column the target (-1 for the last one). the buffer is rearranged accordingly
+		void set_target(int target) {
+			std::vector<double> table(nrows * ncols);
+			for (size_t i = 0; i != nrows; ++i)
+				for (size_t j = 0; j != ncols; ++j)
+					table[i * ncols + j] = at(i, j);
+			assign(table, nrows, ncols, target);
 		}
 
 		// scale values to the interval [-1,1]
 		// WARNING: original values will be lost
-		void normalize() { 
+		void normalize() {
 			double min = 0, max = 0;
 			// first pass to determine min and max
-			for (auto & row : rows) {
-				for (auto v : row) {
-					if (min > v) min = v;
-					if (max < v) max = v;
+			bounds(min, max);
+			// second pass to normalize
+			normalize(min, max);
+		}
+
+		void print() {
+			for (size_t i = 0; i != nrows; ++i) {
+				for (size_t j = 0; j != ncols; ++j) {
+					std::cout << at(i, j) << " ";
 				}
+				std::cout << std::endl;
 			}
-			// second pass to normalize
-			for (auto & row : rows) {
-				for (auto & v : row) {
-					v = 2 * (v - min) / max - min - 1;
+		}
+
+		/// the binary cache used for a text file (one per precision)
+		static std::string cache_path(const char* filename) { return std::string(filename) + (sizeof(T) == sizeof(double) ? ".cache" : ".f32.cache"); }
+
+		/// writes the dataset in binary form (to a temporary file first, so readers never see a partial file).
+		/// key is stored in the header and checked by read_binary. returns false if the file could not be written
+		bool write_binary(const char* filename, uint64_t key = 0) const {
+			std::string packed;
+			const binary_header h = make_header(key, packed);
+			const std::string tmp = std::string(filename) + ".tmp";
+			FILE *f = std::fopen(tmp.c_str(), "wb");
+			if (!f) return false;
+			const char pad[64] = {};
+			bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1
+				&& std::fwrite(packed.data(), 1, packed.size(), f) == packed.size()
+				&& std::fwrite(pad, 1, h.data_offset - sizeof(h) - packed.size(), f) == h.data_offset - sizeof(h) - packed.size()
+				&& std::fwrite(values, sizeof(T), nrows * ncols, f) == nrows * ncols;
+			ok = std::fclose(f) == 0 && ok;
+			if (!ok || std::rename(tmp.c_str(), filename) != 0) { std::remove(tmp.c_str()); return false; }
+			return true;
+		}
+
+		/// maps a file written by write_binary and uses its values in place. returns false (and leaves the
+		/// dataset unchanged) if the file is missing, malformed, or was written with another key
+		bool read_binary(const char* filename, uint64_t key = 0) {
+			std::shared_ptr<mapped_file> file;
+			try { file = std::make_shared<mapped_file>(filename, true); } catch (...) { return false; }
+			if (file->size() < sizeof(binary_header)) return false;
+			binary_header h;
+			std::memcpy(&h, file->data(), sizeof(h));
+			if (!valid_header(h, file->size()) || h.key != key) return false;
+			std::vector<std::string> n;
+			unpack_names(file->data() + sizeof(h), h, n);
+			mapping = file;
+			storage.clear();
+			values = reinterpret_cast<T*>(mapping->data() + h.data_offset);
+			names.swap(n);
+			nrows = h.rows;
+			ncols = h.columns;
+			target_col = h.target;
+			norm.applied = h.normalized != 0;
+			norm.min = h.norm_min;
+			norm.max = h.norm_max;
+			return true;
+		}
+
+	private:
+		template<typename> friend class basic_dataset;
+		template<typename> friend class basic_chunked_dataset;
+
+		/// widens [min, max] to the values
+		void bounds(double& min, double& max) const {
+			const size_t n = nrows * ncols;
+			for (size_t i = 0; i != n; ++i) {
+				double v = values[i];
+				if (min > v) min = v;
+				if (max < v) max = v;
+			}
+		}
+
+		/// normalize() with the given bounds, which may come from more values than these
+		void normalize(double min, double max) {
+			const size_t n = nrows * ncols;
+			for (size_t i = 0; i != n; ++i) {
+				T & v = values[i];
+				v = 2 * (v - min) / max - min - 1;
+			}
+			norm.applied = true;
+			norm.min = min;
+			norm.max = max;
+		}
+
+		static const char* binary_magic() { return "METADATA"; }
+		static const uint32_t binary_version = 2;
+
+		struct binary_header {
+			char magic[8];
+			uint32_t version;
+			uint32_t normalized;
+			uint64_t key; // identifies the options the text was loaded with
+			uint64_t rows, columns, target;
+			double norm_min, norm_max;
+			uint64_t names_count, names_size; // the names follow the header
+			uint64_t data_offset; // rows * columns values, laid out like dataset's buffer
+			uint64_t scalar_size; // bytes per value
+		};
+
+		/// the header of a binary file holding this dataset, and the packed names that follow it
+		binary_header make_header(uint64_t key, std::string& packed) const {
+			binary_header h;
+			std::memset(&h, 0, sizeof(h));
+			std::memcpy(h.magic, binary_magic(), sizeof(h.magic));
+			h.version = binary_version;
+			h.key = key;
+			h.rows = nrows;
+			h.columns = ncols;
+			h.target = target_col;
+			h.normalized = norm.applied;
+			h.norm_min = norm.min;
+			h.norm_max = norm.max;
+			packed.clear(); // names, each followed by a null
+			for (auto & name : names) { packed += name; packed += '\0'; }
+			h.names_count = names.size();
+			h.scalar_size = sizeof(T);
+			h.names_size = packed.size();
+			h.data_offset = (sizeof(h) + packed.size() + 63) / 64 * 64;
+			return h;
+		}
+
+		/// checks a header (but not its key) against the size of its file
+		static bool valid_header(const binary_header& h, uint64_t file_size) {
+			return std::memcmp(h.magic, binary_magic(), sizeof(h.magic)) == 0 && h.version == binary_version
+				&& h.scalar_size == sizeof(T) && h.columns != 0 && h.target < h.columns && h.data_offset >= sizeof(h) + h.names_size
+				&& h.data_offset % 8 == 0 && file_size == h.data_offset + h.rows * h.columns * sizeof(T);
+		}
+
+		/// the names packed after the header, p pointing to the first one
+		static void unpack_names(const char *p, const binary_header& h, std::vector<std::string>& names) {
+			const char *end = p + h.names_size;
+			for (uint64_t i = 0; i != h.names_count && p < end; ++i) {
+				names.push_back(std::string(p));
+				p += names.back().size() + 1;
+			}
+		}
+
+		/// fingerprint of the options that change the loaded values (FNV-1a)
+		static uint64_t options_key(const load_options& options) {
+			std::string s = options.delimiters;
+			s += options.header ? 'h' : '-';
+			s += options.normalize ? 'n' : '-';
+			s += std::to_string(options.target);
+			uint64_t h = 14695981039346656037ull;
+			for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+			return h;
+		}
+
+		/// true if a exists and was modified no earlier than b
+		static bool newer_or_same(const char* a, const char* b) {
+			struct stat sa, sb;
+			if (::stat(a, &sa) != 0 || ::stat(b, &sb) != 0) return false;
+			if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec) return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec;
+			return sa.st_mtim.tv_nsec >= sb.st_mtim.tv_nsec;
+		}
+
+		void load(const char* filename, const load_options& options) {
+			mapped_file file(filename);
+			const char *begin = file.data(), *end = begin + file.size();
+			const delimiter_set delimiters((options.delimiters + "\r").c_str());
+			if (options.header) begin = read_names(begin, end, delimiters, names);
+			const size_t columns = first_columns(begin, end, delimiters);
+			if (columns == 0) { assign(std::vector<double>(), 0, 0, options.target); return; }
+
+			worker_pool pool(options.threads > 0 ? options.threads : worker_pool::hardware_threads());
+			// line-aligned chunks, a few per thread so that uneven lines even out
+			const size_t nchunks = pool.size() == 1 ? 1 : pool.size() * 4;
+			std::vector<const char*> bounds(nchunks + 1, end);
+			bounds[0] = begin;
+			for (size_t k = 1; k < nchunks; ++k) {
+				const char *p = std::max(bounds[k-1], begin + (end - begin) * k / nchunks);
+				if (p != begin && p[-1] != '\n') { // move to the start of the next line
+					p = end_of_line(p, end);
+					if (p != end) ++p;
+				}
+				bounds[k] = p;
+			}
+			// first pass counts the rows of every chunk, second pass parses them into place
+			std::vector<size_t> offsets(nchunks + 1, 0);
+			pool.run(nchunks, [&](int, size_t b, size_t e) {
+				for (size_t k = b; k != e; ++k)
+					offsets[k + 1] = count_rows(bounds[k], bounds[k + 1], delimiters);
+			});
+			for (size_t k = 0; k != nchunks; ++k)
+				offsets[k + 1] += offsets[k];
+			allocate(offsets[nchunks], columns, options.target);
+			std::vector<char> failed(nchunks, 0);
+			pool.run(nchunks, [&](int, size_t b, size_t e) {
+				for (size_t k = b; k != e; ++k)
+					failed[k] = !parse_rows(bounds[k], bounds[k + 1], delimiters, offsets[k]);
+			});
+			for (auto f : failed)
+				if (f) { throw "Malformed data file."; }
+		}
+
+		/// reads the column names from the first line into names, and returns the start of the next one
+		static const char* read_names(const char *begin, const char *end, const delimiter_set& delimiters, std::vector<std::string>& names) {
+			if (begin == end) return end;
+			const char *eol = end_of_line(begin, end);
+			for (const char *p = begin; p != eol; ) {
+				while (p != eol && delimiters(*p)) ++p;
+				const char *q = p;
+				while (q != eol && !delimiters(*q)) ++q;
+				if (q != p) names.push_back(std::string(p, q));
+				p = q;
+			}
+			return eol == end ? end : eol + 1;
+		}
+
+		/// the number of columns, which the first line with data decides (0 if there is none)
+		static size_t first_columns(const char *begin, const char *end, const delimiter_set& delimiters) {
+			size_t columns = 0;
+			for (const char *p = begin; p != end && columns == 0; ) {
+				const char *eol = end_of_line(p, end);
+				columns = count_fields(p, eol, delimiters);
+				p = eol == end ? end : eol + 1;
+			}
+			return columns;
+		}
+
+		static const char* end_of_line(const char *p, const char *end) {
+			const void *eol = std::memchr(p, '\n', end - p);
+			return eol ? static_cast<const char*>(eol) : end;
+		}
+
+		static size_t count_fields(const char *p, const char *eol, const delimiter_set& delimiters) {
+			size_t n = 0;
+			while (p != eol) {
+				while (p != eol && delimiters(*p)) ++p;
+				if (p == eol) break;
+				++n;
+				while (p != eol && !delimiters(*p)) ++p;
+			}
+			return n;
+		}
+
+		static size_t count_rows(const char *p, const char *end, const delimiter_set& delimiters) {
+			size_t n = 0;
+			while (p != end) {
+				const char *eol = end_of_line(p, end);
+				for (const char *q = p; q != eol; ++q)
+					if (!delimiters(*q)) { ++n; break; }
+				p = eol == end ? end : eol + 1;
+			}
+			return n;
+		}
+
+		/// parses the non-empty lines in [p, end) as rows first, first + 1, ...
+		bool parse_rows(const char *p, const char *end, const delimiter_set& delimiters, size_t first) {
+			const size_t nin = ncols - 1;
+			T *t = values + nrows * nin;
+			size_t i = first;
+			while (p != end) {
+				const char *eol = end_of_line(p, end);
+				size_t j = 0;
+				T *x = values + i * nin;
+				while (p != eol) {
+					while (p != eol && delimiters(*p)) ++p;
+					if (p == eol) break;
+					double v;
+					const char *q = parse_double(p, eol, v);
+					if (q == p || (q != eol && !delimiters(*q))) return false;
+					if (j == ncols) return false;
+					if ((int)j == target_col) t[i] = v;
+					else *x++ = v;
+					++j;
+					p = q;
 				}
+				if (j != 0) {
+					if (j != ncols) return false;
+					++i;
+				}
+				p = eol == end ? end : eol + 1;
 			}
+			return true;
 		}
 
-		double print() {
-			for (auto & row : rows) {
-				for (auto v : row) {
-					std::cout << v << " ";
+		/// position of source column j among the inputs
+		size_t input_index(size_t j) const { return (int)j < target_col ? j : j - 1; }
+
+		void allocate(size_t rows, size_t columns, int target) {
+			if (target < 0) target = columns - 1;
+			if ((size_t)target >= columns) { throw "Target column out of range."; }
+			nrows = rows;
+			ncols = columns;
+			target_col = target;
+			storage.assign(nrows * ncols, T(0));
+			values = storage.data();
+			mapping.reset();
+		}
+
+		/// like allocate(), but leaves the values undefined and reuses the buffer when it is large enough
+		void reshape(size_t rows, size_t columns, int target) {
+			nrows = rows;
+			ncols = columns;
+			target_col = target;
+			if (storage.size() < nrows * ncols) storage.resize(nrows * ncols);
+			values = storage.data();
+			mapping.reset();
+		}
+
+		/// lays out a row-major (rows x columns) table as inputs followed by the target column
+		void assign(const std::vector<double>& table, size_t rows, size_t columns, int target) {
+			if (columns == 0) { nrows = ncols = 0; target_col = 0; storage.clear(); mapping.reset(); values = nullptr; return; }
+			allocate(rows, columns, target);
+			T *x = values;
+			T *t = x + nrows * (ncols - 1);
+			for (size_t i = 0; i != nrows; ++i) {
+				const double *r = &table[i * ncols];
+				for (size_t j = 0; j != ncols; ++j) {
+					if ((int)j == target_col) t[i] = r[j];
+					else *x++ = r[j];
 				}
-				std::cout << std::endl;
 			}
 		}
 
-    dataset(const std::vector<std::vector<double>>& rows_) : rows(rows_) {}
-    std::vector<std::vector<double>> rows;
+		std::vector<T> storage; // owns the values, unless they come from a mapped binary file
+		std::shared_ptr<mapped_file> mapping;
+		T *values; // nrows * ncols values, in storage or in mapping
+		std::vector<std::string> names;
+		normalization_params norm;
+		size_t nrows, ncols;
+		int target_col;
 };
 
+typedef basic_dataset<double> dataset;
+
 #endif // DATASET_HPP
@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/// memory mapping of a whole file (unmapped on destruction). the mapping is read-only unless
+/// copy_on_write is set, in which case it can be modified without the changes reaching the file
+class mapped_file {
+public:
+	explicit mapped_file(const char* filename, bool copy_on_write = false) : ptr(nullptr), length(0) {
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0) { throw "Could not open file."; }
+		struct stat st;
+		if (::fstat(fd, &st) != 0) { ::close(fd); throw "Could not open file."; }
+		length = st.st_size;
+		if (length > 0) {
+			void *p = ::mmap(nullptr, length, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) { ::close(fd); throw "Could not map file."; }
+			ptr = static_cast<char*>(p);
+			::madvise(p, length, MADV_SEQUENTIAL);
+		}
+		::close(fd);
+	}
+
+	~mapped_file() {
+		if (ptr) ::munmap(ptr, length);
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const char* data() const { return ptr; }
+	char* data() { return ptr; } // only writable with copy_on_write
+	size_t size() const { return length; }
+
+private:
+	char *ptr;
+	size_t length;
+};
+
+#endif // MAPPED_FILE_H
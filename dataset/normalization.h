@@ -0,0 +1,13 @@
+#ifndef NORMALIZATION_H
+#define NORMALIZATION_H
+
+/// parameters of the last normalize() call: v' = 2 (v - min) / max - min - 1
+struct normalization_params {
+	normalization_params() : applied(false), min(0), max(0) {}
+	bool applied;
+	double min, max;
+	double apply(double v) const { return applied ? 2 * (v - min) / max - min - 1 : v; }
+	double revert(double v) const { return applied ? (v + min + 1) * max / 2 + min : v; }
+};
+
+#endif // NORMALIZATION_H
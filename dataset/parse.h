@@ -0,0 +1,77 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+/// allocation-free helpers for parsing delimited text held in memory
+
+/// a set of delimiter characters, as a lookup table
+struct delimiter_set {
+	explicit delimiter_set(const char *chars) {
+		std::memset(table, 0, sizeof(table));
+		for (const char *c = chars; *c; ++c)
+			table[(unsigned char)*c] = true;
+	}
+	bool operator()(char c) const { return table[(unsigned char)c]; }
+	bool table[256];
+};
+
+/// Parses the number starting at p (and ending before end) into v and returns the position after it.
+/// Plain decimals with up to 18 significant digits and a decimal exponent of at most 22 are converted with
+/// a single multiplication or division by an exact power of ten, which is correctly rounded (Clinger's fast
+/// path), so the result is the same as strtod's. Everything else (long mantissas, large exponents, inf, nan)
+/// is handed to strtod. An exponent marker with no digits ("1e", "2.5E+") is skipped and the number read
+/// without it, as atof did. Returns p if there is no number at p.
+inline const char* parse_double(const char *p, const char *end, double& v) {
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *start = p;
+	bool negative = false;
+	if (p != end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; p != end && *p >= '0' && *p <= '9'; ++p, any = true) {
+		if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; }
+		else ++exponent; // digits beyond the 19th only scale the value
+	}
+	if (p != end && *p == '.') {
+		for (++p; p != end && *p >= '0' && *p <= '9'; ++p, any = true) {
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ++digits; --exponent; }
+		}
+	}
+	bool exact = digits < 19 || mantissa == 0;
+	const char *decimal_end = p;
+	if (any && p != end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = false;
+		if (q != end && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+		int e = 0;
+		for (; q != end && *q >= '0' && *q <= '9'; ++q)
+			if (e < 100000) e = e * 10 + (*q - '0');
+		exponent += eneg ? -e : e;
+		p = q; // a marker without digits is skipped too
+	}
+	if (any && exact && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+		double x = (double)mantissa;
+		x = exponent < 0 ? x / pow10[-exponent] : x * pow10[exponent];
+		v = negative ? -x : x;
+		return p;
+	}
+	// slow path: let strtod deal with it (it needs a null-terminated copy)
+	char buf[128];
+	size_t n = 0;
+	const char *q = start;
+	while (q != end && n + 1 < sizeof(buf) && !(*q == ' ' || *q == '\t' || *q == ',' || *q == ';' || *q == '\n' || *q == '\r'))
+		buf[n++] = *q++;
+	buf[n] = '\0';
+	char *e;
+	v = std::strtod(buf, &e);
+	const char *stop = start + (e - buf);
+	// strtod stops before an exponent marker without digits, which is skipped here as well
+	return any && stop >= decimal_end ? p : stop;
+}
+
+#endif // PARSE_H
@@ -0,0 +1,185 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+/// Binary GA checkpoints. A checkpoint holds a checkpoint_header followed by the population, best first:
+/// for every individual its fitness (a double) and its genome as written by genome_traits<Genome>::write.
+/// Values are stored in the byte order of the machine that wrote them.
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t random_words; // size of random_state actually used
+    uint64_t generation; // generations done since initialize()
+    uint64_t evaluations; // fitness evaluations since initialize()
+    uint64_t population; // number of individuals that follow
+    uint64_t random_state[4]; // position of the optimizer's generator
+    uint64_t value_size; // bytes per genome value (see genome_traits::value_size)
+    uint64_t genome_length; // values per genome, the same for every individual
+
+    static const char* expected_magic() { return "METAGACP"; }
+    static const uint32_t expected_version = 2;
+};
+
+namespace checkpoint_detail {
+    inline void append(std::string& out, const void *p, size_t n) {
+        out.append(static_cast<const char*>(p), n);
+    }
+
+    /// copies n bytes from p to dst and moves p past them, if there are that many before end
+    inline bool take(const char*& p, const char *end, void *dst, size_t n) {
+        if ((size_t)(end - p) < n) return false;
+        std::memcpy(dst, p, n);
+        p += n;
+        return true;
+    }
+
+    /// writes data to a temporary file renamed to filename, so that a crash never leaves a partial checkpoint
+    inline bool write_file(const std::string& filename, const std::string& data) {
+        const std::string tmp = filename + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+        ok = std::fclose(f) == 0 && ok;
+        if (!ok || std::rename(tmp.c_str(), filename.c_str()) != 0) { std::remove(tmp.c_str()); return false; }
+        return true;
+    }
+
+    inline bool read_file(const std::string& filename, std::string& data) {
+        FILE *f = std::fopen(filename.c_str(), "rb");
+        if (!f) return false;
+        data.clear();
+        char buffer[1 << 16];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), f)) != 0)
+            data.append(buffer, n);
+        const bool ok = !std::ferror(f);
+        std::fclose(f);
+        return ok;
+    }
+}
+
+/// the size and the number of the values of a genome, recorded in checkpoints so that one written for other genomes
+/// (another network, another precision) is not read as if it matched
+template<typename Genome>
+struct genome_values {
+    static const uint64_t size = sizeof(Genome);
+    static uint64_t length(const Genome&) { return 1; }
+};
+
+template<typename T, typename A>
+struct genome_values<std::vector<T, A>> {
+    static const uint64_t size = sizeof(T);
+    static uint64_t length(const std::vector<T, A>& g) { return g.size(); }
+};
+
+/// genome serialization for vectors of plain values: the element count, then the elements
+template<typename T, typename A>
+void write_genome(std::string& out, const std::vector<T, A>& g) {
+    static_assert(std::is_trivially_copyable<T>::value, "specialize genome_traits to checkpoint this genome");
+    const uint64_t n = g.size();
+    checkpoint_detail::append(out, &n, sizeof(n));
+    checkpoint_detail::append(out, g.data(), n * sizeof(T));
+}
+
+template<typename T, typename A>
+bool read_genome(const char*& p, const char *end, std::vector<T, A>& g) {
+    uint64_t n;
+    if (!checkpoint_detail::take(p, end, &n, sizeof(n)) || n > (uint64_t)(end - p) / sizeof(T)) return false;
+    g.resize(n);
+    return checkpoint_detail::take(p, end, g.data(), n * sizeof(T));
+}
+
+/// and for plain values
+template<typename Genome>
+void write_genome(std::string& out, const Genome& g) {
+    static_assert(std::is_trivially_copyable<Genome>::value, "specialize genome_traits to checkpoint this genome");
+    checkpoint_detail::append(out, &g, sizeof(g));
+}
+
+template<typename Genome>
+bool read_genome(const char*& p, const char *end, Genome& g) {
+    return checkpoint_detail::take(p, end, &g, sizeof(g));
+}
+
+/**
+ * @brief Writes checkpoints on a background thread
+ *
+ * write() hands a serialized checkpoint over and returns at once, so the file system is never waited for
+ * in the generation loop. Only the latest checkpoint matters: one submitted while the previous one is still
+ * waiting replaces it. The buffers are swapped rather than copied, so the caller gets an old buffer back to
+ * serialize the next checkpoint into.
+ */
+class checkpoint_writer {
+public:
+    checkpoint_writer() : queued(false), busy(false), failed(false), stop(false), thread(&checkpoint_writer::loop, this) {}
+
+    ~checkpoint_writer() {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    checkpoint_writer(const checkpoint_writer&) = delete;
+    checkpoint_writer& operator=(const checkpoint_writer&) = delete;
+
+    /// queues data to be written to filename. data is left with the contents of a previous checkpoint
+    void write(const std::string& filename, std::string& data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            path = filename;
+            pending.swap(data);
+            queued = true;
+        }
+        wake.notify_all();
+    }
+
+    /// waits until the queued checkpoint is on disk. returns false if a write failed since the last flush
+    bool flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return !queued && !busy; });
+        const bool ok = !failed;
+        failed = false;
+        return ok;
+    }
+
+private:
+    void loop() {
+        std::string filename, data;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] { return queued || stop; });
+            if (!queued) return;
+            filename = path;
+            data.swap(pending);
+            queued = false;
+            busy = true;
+            lock.unlock();
+            const bool ok = checkpoint_detail::write_file(filename, data);
+            lock.lock();
+            busy = false;
+            failed = failed || !ok;
+            done.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::string path, pending;
+    bool queued, busy, failed, stop;
+    std::thread thread; // last, so that it starts once the rest is constructed
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,497 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "../random/random.h"
+#include "../parallel/worker_pool.h"
+#include "selection.h"
+#include "telemetry.h"
+#include "fitness_cache.h"
+#include "checkpoint.h"
+#include "../statistics/statistics.h"
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <functional>
+#include <memory>
+
+/// an individual of the statically dispatched GA: a genome held by value, and its fitness.
+/// dirty is set when a variation operator has changed the genome since its fitness was computed
+template<typename Genome>
+struct ga_member {
+    Genome genome;
+    double fitness = 0;
+    bool dirty = true;
+};
+
+template<typename Genome>
+size_t hash_genome(const Genome& g) { return std::hash<Genome>()(g); }
+
+template<typename T, typename A>
+size_t hash_genome(const std::vector<T, A>& g) {
+    size_t h = g.size();
+    for (auto & x : g)
+        h ^= std::hash<T>()(x) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
+}
+
+/// how the engine copies genomes. assignment reuses the destination's storage for the standard
+/// containers, so copying a std::vector genome into an existing individual does not allocate.
+/// hash and equal are only used by the fitness cache; write, read, value_size and length by checkpoints (see
+/// checkpoint.h). A genome that cannot be checkpointed sets checkpointable to false and leaves those out
+template<typename Genome>
+struct genome_traits {
+    static void copy(Genome& dst, const Genome& src) { dst = src; }
+    static size_t hash(const Genome& g) { return hash_genome(g); }
+    static bool equal(const Genome& a, const Genome& b) { return a == b; }
+    static const bool checkpointable = true;
+    static void write(std::string& out, const Genome& g) { write_genome(out, g); }
+    static bool read(const char*& p, const char *end, Genome& g) { return read_genome(p, end, g); }
+    static const uint64_t value_size = genome_values<Genome>::size;
+    static uint64_t length(const Genome& g) { return genome_values<Genome>::length(g); }
+};
+
+/// how the engine hands the genomes of a generation to the evaluator. by default each one goes to the evaluator
+/// of the worker it falls to. An evaluator that is cheaper on all of them at once (one that streams its data once
+/// per generation, say) specializes this with batched = true and an evaluate_all that writes the fitness of every
+/// genome to fitness, spreading the work over the pool as it sees fit
+template<typename Evaluator>
+struct evaluator_traits {
+    static const bool batched = false;
+    template<typename Genome>
+    static void evaluate_all(Evaluator&, worker_pool&, const std::vector<const Genome*>&, double*) {}
+};
+
+template<bool desc = false>
+struct compare {
+    template<typename T>
+    bool operator()(const T *a, const T *b) const {
+        return desc ? b->fitness < a->fitness : b->fitness > a->fitness;
+    }
+};
+
+/**
+ * @brief Statically dispatched generational GA
+ *
+ * The individuals are ga_member<Genome> values and the operators are plain function objects working on the
+ * genome, called through their concrete types so they can be inlined into the generation loop:
+ *
+ *   Creator:     void operator()(Genome& g)              fills a new genome
+ *   Evaluator:   double operator()(const Genome& g)      returns the fitness
+ *                Evaluator* clone() const                an evaluator for another thread
+ *   CrossoverOp: void operator()(Genome& a, Genome& b)
+ *   MutationOp:  void operator()(Genome& g)
+ *
+ * Every operator has a public rnd *r member, set by set_random(). The engine owns 2 * population size
+ * individuals in one contiguous block; pop and sel are buffers of pointers into it. Selection copies parents
+ * into sel, and reinsertion hands the individuals that did not survive back to sel for the next generation,
+ * so a generation does not allocate (as long as copying a genome into another does not).
+ *
+ * With threads > 1 the fitness evaluations are spread over a fixed pool of worker threads, every worker
+ * using its own Evaluator::clone() (worker 0 uses eval itself). Fitness values do not depend on the number
+ * of threads. An evaluator with a batched evaluator_traits gets all the genomes to evaluate at once instead.
+ *
+ * Only individuals changed by crossover or mutation (dirty ones) are evaluated: an offspring that is still a
+ * plain copy of its parent keeps the parent's fitness. With fitness_cache_size > 0, the fitness of evaluated
+ * genomes is also kept in a fitness_cache of that many slots, and a dirty genome found there is not evaluated
+ * again. Both assume the evaluator is a pure function of the genome.
+ *
+ * When an observer is attached, every phase of a generation is timed and the observer receives a
+ * generation_stats after each one (see telemetry.h). Without one the generation loop is left as it is.
+ *
+ * With a checkpoint_path, the population, the counters and the state of the generator are saved every
+ * checkpoint_interval generations. The snapshot is taken in the generation loop and written by a background
+ * thread (see checkpoint.h). load_checkpoint() restores such a state, after which evolve() continues exactly
+ * as the interrupted run would have, given the same operators and a generator shared by them. Checkpoints
+ * record the size and the number of the values of the genomes, and one that does not match the genomes of this
+ * engine (or genome_length, if set) is rejected. Genomes whose genome_traits are not checkpointable are never
+ * checkpointed, and the calls that read or write checkpoints do not compile for them.
+ */
+template<class Genome, class Evaluator, class Creator, class CrossoverOp, class MutationOp, class SelectionOp = roulette_selection>
+class ga_engine {
+public:
+    typedef ga_member<Genome> member_type;
+
+    ga_engine(int pop_size) :
+        mutation_probability(0.25),
+        threads(1),
+        create(nullptr),
+        eval(nullptr),
+        crossoverOp(nullptr),
+        mutateOp(nullptr),
+        observer(nullptr),
+        fitness_cache_size(0),
+        checkpoint_interval(10),
+        genome_length(0),
+        unchanged(0),
+        cache_hits(0),
+        r(nullptr),
+        population_size(pop_size),
+        elites(1),
+        generation(0),
+        evaluations(0) {}
+
+    void start(int generations) {
+        std::cout << "--- Start" << std::endl;
+        initialize(); // initialize population
+        evolve(generations);
+    }
+
+    /// creates and evaluates the initial population
+    void initialize() { initialize(std::vector<Genome>()); }
+
+    /// creates and evaluates the initial population, starting with copies of the given genomes (a warm start
+    /// from the best individuals of a previous run, see load_genomes()). the creator makes the others
+    void initialize(const std::vector<Genome>& seeds) {
+        allocate();
+        for (int i = 0; i != population_size; ++i) {
+            if ((size_t)i < seeds.size()) genome_traits<Genome>::copy(pop[i]->genome, seeds[i]);
+            else (*create)(pop[i]->genome);
+        }
+        for (int i = 0; i != population_size; ++i)
+            copy(*sel[i], *pop[i]);
+        generation = 0;
+        evaluations = 0;
+        if (observer) {
+            generation_stats s;
+            s.evaluate_seconds = timed([&] { do_evaluate(pop); });
+            sort_population();
+            report(s);
+        } else {
+            do_evaluate(pop);
+            sort_population();
+        }
+    }
+
+    /// runs the given number of generations on the current population (initialize() must have been called)
+    void evolve(int generations) {
+        for (int i = 0; i != generations; ++i) {
+            if (observer) {
+                instrumented_generation();
+            } else {
+                do_select();
+                do_crossover();
+                do_mutation();
+                evaluations += do_evaluate(sel);
+                do_reinsert();
+                ++generation;
+            }
+            if (!checkpoint_path.empty() && checkpoint_interval > 0 && generation % checkpoint_interval == 0)
+                write_checkpoint(std::integral_constant<bool, genome_traits<Genome>::checkpointable>());
+        }
+        sort_population();
+    }
+
+    /// the population, sorted descending by fitness (after initialize() or evolve())
+    const std::vector<member_type*>& population() const { return pop; }
+
+    /// overwrites the worst individuals with copies of the given ones (used for migration between islands)
+    void immigrate(const std::vector<const member_type*>& migrants) {
+        for (size_t i = 0; i != migrants.size() && i < pop.size(); ++i) {
+            copy(*pop[pop.size() - 1 - i], *migrants[i]);
+            pop[pop.size() - 1 - i]->dirty = false; // migrants come with their fitness
+        }
+        sort_population();
+    }
+
+    member_type* best() {
+        return pop.front();
+    }
+
+    /// generations done since initialize() (or since the initialization of a loaded checkpoint's run)
+    int generations() const { return generation; }
+
+    /// writes the current state to path and waits for it. returns false if it could not be written
+    bool save_checkpoint(const std::string& path) {
+        static_assert(genome_traits<Genome>::checkpointable, "these genomes cannot be checkpointed (see genome_traits)");
+        flush_checkpoints(); // the background writer may be writing to the same temporary file
+        serialize(snapshot);
+        return checkpoint_detail::write_file(path, snapshot);
+    }
+
+    /// restores a state saved by a checkpoint of a run with the same population size (and genome_length, if set),
+    /// replacing initialize(). returns false (and leaves the engine as it was) if the file is missing, malformed or
+    /// does not match
+    bool load_checkpoint(const std::string& path) {
+        static_assert(genome_traits<Genome>::checkpointable, "these genomes cannot be checkpointed (see genome_traits)");
+        checkpoint_header h;
+        std::vector<member_type> members;
+        if (!read_checkpoint(path, h, members) || h.population != (uint64_t)population_size
+                || (genome_length != 0 && h.genome_length != genome_length)) return false;
+        allocate();
+        for (int i = 0; i != population_size; ++i) {
+            copy(*pop[i], members[i]);
+            copy(*sel[i], members[i]);
+        }
+        generation = h.generation;
+        evaluations = h.evaluations;
+        r->set_state(h.random_state);
+        return true;
+    }
+
+    /// the genomes of a checkpoint, best first, for a warm start. returns false if it cannot be read
+    static bool load_genomes(const std::string& path, std::vector<Genome>& genomes) {
+        static_assert(genome_traits<Genome>::checkpointable, "these genomes cannot be checkpointed (see genome_traits)");
+        checkpoint_header h;
+        std::vector<member_type> members;
+        if (!read_checkpoint(path, h, members)) return false;
+        genomes.resize(members.size());
+        for (size_t i = 0; i != members.size(); ++i)
+            genome_traits<Genome>::copy(genomes[i], members[i].genome);
+        return true;
+    }
+
+    /// waits for the checkpoint being written in the background, if any. returns false if a write failed
+    bool flush_checkpoints() {
+        return writer ? writer->flush() : true;
+    }
+
+    void set_random(rnd *r) {
+        this->r = r;
+        create->r = r;
+        eval->r = r;
+        crossoverOp->r = r;
+        mutateOp->r = r;
+        selection.r = r;
+    }
+
+    double mutation_probability;
+    int threads; // number of threads used for fitness evaluation
+
+    Creator *create;
+    Evaluator *eval;
+    CrossoverOp *crossoverOp;
+    MutationOp *mutateOp;
+    SelectionOp selection;
+    ga_observer *observer; // receives the telemetry of every generation, if set
+    size_t fitness_cache_size; // slots of the fitness cache, 0 for none (applied by initialize())
+    std::string checkpoint_path; // written every checkpoint_interval generations if not empty
+    int checkpoint_interval;
+    uint64_t genome_length; // values per genome that load_checkpoint() accepts, 0 for any
+
+private:
+    static void copy(member_type& dst, const member_type& src) {
+        genome_traits<Genome>::copy(dst.genome, src.genome);
+        dst.fitness = src.fitness;
+        dst.dirty = src.dirty;
+    }
+
+    /// creates the individuals and the evaluation workers
+    void allocate() {
+        storage.clear();
+        storage.resize(2 * population_size);
+        pop.resize(population_size);
+        sel.resize(population_size);
+        next.resize(population_size);
+        for (int i = 0; i != population_size; ++i) {
+            pop[i] = &storage[i];
+            sel[i] = &storage[population_size + i];
+        }
+        setup_workers();
+        cache.resize(fitness_cache_size);
+    }
+
+    /// sorts descending by fitness. a sorted population is left as it is, so the order of equal
+    /// fitnesses only depends on the generation loop (and a checkpoint restores it exactly)
+    void sort_population() {
+        const bool descending = true;
+        if (!std::is_sorted(begin(pop), end(pop), compare<descending>()))
+            std::sort(begin(pop), end(pop), compare<descending>());
+    }
+
+    void serialize(std::string& out) const {
+        checkpoint_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, checkpoint_header::expected_magic(), sizeof(h.magic));
+        h.version = checkpoint_header::expected_version;
+        h.random_words = engine_type::state_size;
+        h.generation = generation;
+        h.evaluations = evaluations;
+        h.population = pop.size();
+        r->get_state(h.random_state);
+        h.value_size = genome_traits<Genome>::value_size;
+        h.genome_length = pop.empty() ? 0 : genome_traits<Genome>::length(pop.front()->genome);
+        out.clear();
+        checkpoint_detail::append(out, &h, sizeof(h));
+        for (auto ind : pop) {
+            checkpoint_detail::append(out, &ind->fitness, sizeof(ind->fitness));
+            genome_traits<Genome>::write(out, ind->genome);
+        }
+    }
+
+    static bool read_checkpoint(const std::string& path, checkpoint_header& h, std::vector<member_type>& members) {
+        std::string data;
+        if (!checkpoint_detail::read_file(path, data)) return false;
+        const char *p = data.data(), *end = p + data.size();
+        if (!checkpoint_detail::take(p, end, &h, sizeof(h))
+                || std::memcmp(h.magic, checkpoint_header::expected_magic(), sizeof(h.magic)) != 0
+                || h.version != checkpoint_header::expected_version || h.random_words != engine_type::state_size
+                || h.value_size != genome_traits<Genome>::value_size || h.population > data.size()) return false;
+        members.resize(h.population);
+        for (auto & m : members) {
+            if (!checkpoint_detail::take(p, end, &m.fitness, sizeof(m.fitness)) || !genome_traits<Genome>::read(p, end, m.genome)
+                    || genome_traits<Genome>::length(m.genome) != h.genome_length)
+                return false;
+            m.dirty = false;
+        }
+        return p == end;
+    }
+
+    void write_checkpoint(std::true_type) {
+        serialize(snapshot);
+        if (!writer) writer.reset(new checkpoint_writer);
+        writer->write(checkpoint_path, snapshot);
+    }
+
+    void write_checkpoint(std::false_type) {} // genomes that cannot be checkpointed
+
+    void do_select() {
+        selection.prepare(pop);
+        for (size_t i = 0; i != pop.size(); ++i) {
+            copy(*sel[i], *pop[selection()]);
+        }
+    }
+
+    void do_reinsert() {
+        const bool descending = true;
+        std::sort(begin(sel), end(sel), compare<descending>());
+        // the next population is made of the elites and the best of the offspring
+        const size_t n = pop.size(), e = std::min<size_t>(elites, n);
+        std::merge(begin(pop), begin(pop)+e, begin(sel), end(sel)-e, begin(next), compare<descending>());
+        // the rest goes back to sel, to be overwritten by the next selection
+        // (the e worst offspring are already in place at the end of sel)
+        std::copy(begin(pop)+e, end(pop), begin(sel));
+        pop.swap(next);
+    }
+
+    void do_crossover() {
+        for (auto ind : sel) {
+            auto mate = sel[r->next(pop.size()-1)];
+            (*crossoverOp)(ind->genome, mate->genome);
+            ind->dirty = mate->dirty = true;
+        }
+    }
+
+    void do_mutation() {
+        for (auto ind : sel) {
+            if (r->next_double() < mutation_probability) {
+                (*mutateOp)(ind->genome);
+                ind->dirty = true;
+            }
+        }
+    }
+
+    void setup_workers() {
+        int n = threads < 1 ? 1 : threads;
+        if (!pool || pool->size() != n)
+            pool.reset(new worker_pool(n));
+        evals.clear();
+        for (int i = 1; i < n; ++i)
+            evals.push_back(std::unique_ptr<Evaluator>(eval->clone()));
+    }
+
+    template<typename F>
+    static double timed(F f) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+    void instrumented_generation() {
+        generation_stats s;
+        s.select_seconds = timed([&] { do_select(); });
+        s.crossover_seconds = timed([&] { do_crossover(); });
+        s.mutation_seconds = timed([&] { do_mutation(); });
+        s.evaluate_seconds = timed([&] { do_evaluate(sel); });
+        s.reinsert_seconds = timed([&] { do_reinsert(); });
+        ++generation;
+        report(s);
+    }
+
+    /// fills in the counters and the fitness statistics of the current population, and hands s to the observer
+    void report(generation_stats& s) {
+        const size_t evaluated = pending.size(); // by the last do_evaluate()
+        evaluations += evaluated;
+        s.generation = generation;
+        s.evaluations = evaluated;
+        s.unchanged = unchanged;
+        s.cache_hits = cache_hits;
+        s.total_evaluations = evaluations;
+        s.evaluations_per_second = s.evaluate_seconds > 0 ? evaluated / s.evaluate_seconds : 0;
+        fitness_stats.reset();
+        for (auto ind : pop) fitness_stats.add(ind->fitness);
+        s.best_fitness = pop.front()->fitness; // pop is sorted after initialization and reinsertion
+        s.mean_fitness = fitness_stats.mean();
+        s.fitness_stddev = fitness_stats.stddev();
+        observer->on_generation(s);
+    }
+
+    /// evaluates the dirty individuals that are not in the cache, and returns how many were evaluated
+    size_t do_evaluate(std::vector<member_type*>& individuals) {
+        pending.clear();
+        hashes.clear();
+        unchanged = cache_hits = 0;
+        const bool cached = cache.capacity() != 0;
+        for (auto ind : individuals) {
+            if (!ind->dirty) {
+                ++unchanged;
+                continue;
+            }
+            if (cached) {
+                const size_t h = genome_traits<Genome>::hash(ind->genome);
+                if (cache.find(ind->genome, h, ind->fitness)) {
+                    ind->dirty = false;
+                    ++cache_hits;
+                    continue;
+                }
+                hashes.push_back(h);
+            }
+            pending.push_back(ind);
+        }
+        if (evaluator_traits<Evaluator>::batched) {
+            batch.clear();
+            for (auto ind : pending) batch.push_back(&ind->genome);
+            batch_fitness.resize(pending.size());
+            evaluator_traits<Evaluator>::evaluate_all(*eval, *pool, batch, batch_fitness.data());
+            for (size_t i = 0; i != pending.size(); ++i)
+                pending[i]->fitness = batch_fitness[i];
+        } else {
+            pool->run(pending.size(), [&](int worker, size_t begin, size_t end) {
+                auto e = worker == 0 ? eval : evals[worker-1].get();
+                for (size_t i = begin; i != end; ++i)
+                    pending[i]->fitness = (*e)(pending[i]->genome);
+            });
+        }
+        for (size_t i = 0; i != pending.size(); ++i) {
+            pending[i]->dirty = false;
+            if (cached) cache.insert(pending[i]->genome, hashes[i], pending[i]->fitness);
+        }
+        return pending.size();
+    }
+
+    std::vector<member_type> storage; // every individual in pop and sel
+    std::vector<member_type*> pop;
+    std::vector<member_type*> sel;
+    std::vector<member_type*> next; // reinsertion output, swapped with pop
+    std::vector<member_type*> pending; // individuals to evaluate
+    std::vector<size_t> hashes; // of the pending genomes, when the cache is on
+    std::vector<const Genome*> batch; // the pending genomes, for a batched evaluator
+    std::vector<double> batch_fitness;
+    fitness_cache<Genome, genome_traits<Genome>> cache;
+    size_t unchanged; // individuals of the last do_evaluate() that were not dirty
+    size_t cache_hits; // and those that were found in the cache
+    std::string snapshot; // serialized checkpoint, reused
+    std::unique_ptr<checkpoint_writer> writer; // started by the first checkpoint
+
+    std::unique_ptr<worker_pool> pool;
+    std::vector<std::unique_ptr<Evaluator>> evals; // per-worker evaluators (worker 0 uses eval)
+
+    rnd *r;
+    int population_size;
+    int elites;
+    int generation; // generations since initialize()
+    size_t evaluations; // fitness evaluations since initialize()
+    mv_calculator fitness_stats;
+};
+
+#endif // ENGINE_H
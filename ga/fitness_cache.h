@@ -0,0 +1,55 @@
+#ifndef FITNESS_CACHE_H
+#define FITNESS_CACHE_H
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * @brief Bounded cache of the fitness of already evaluated genomes
+ *
+ * A direct-mapped table: a genome can only live in the slot its hash points to, and inserting it replaces
+ * whatever was there. The cache never grows past its capacity, and the slots keep their genome's storage, so
+ * once warm it does not allocate (as long as copying a genome into another does not). A hit compares the
+ * whole genome, so hash collisions never return the fitness of another genome. Hashing and comparing go
+ * through the Traits (genome_traits in engine.h).
+ */
+template<typename Genome, typename Traits>
+class fitness_cache {
+public:
+    explicit fitness_cache(size_t capacity = 0) : slots(capacity) {}
+
+    /// empties the cache and sets its number of slots (0 disables it)
+    void resize(size_t capacity) {
+        slots.clear();
+        slots.resize(capacity);
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    /// the fitness of g, whose hash is h, if it is in the cache
+    bool find(const Genome& g, size_t h, double& fitness) const {
+        auto & s = slots[h % slots.size()];
+        if (!s.used || s.hash != h || !Traits::equal(s.genome, g)) return false;
+        fitness = s.fitness;
+        return true;
+    }
+
+    void insert(const Genome& g, size_t h, double fitness) {
+        auto & s = slots[h % slots.size()];
+        Traits::copy(s.genome, g);
+        s.hash = h;
+        s.fitness = fitness;
+        s.used = true;
+    }
+
+private:
+    struct slot {
+        Genome genome;
+        size_t hash = 0;
+        double fitness = 0;
+        bool used = false;
+    };
+    std::vector<slot> slots;
+};
+
+#endif // FITNESS_CACHE_H
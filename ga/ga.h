@@ -2,9 +2,9 @@
 #define GA_H
 
 #include "../random/random.h"
+#include "engine.h"
 #include <vector>
-#include <algorithm>
-#include <iostream>
+#include <memory>
 
 /**
  * @brief Base class for all genetic operators
@@ -20,51 +20,139 @@ public:
  * @brief The ga_individual class
  *
  * Interface for classes representing a GA individual.
+ * copy_from() overwrites an existing individual with another one (genome and fitness), reusing its
+ * storage. The optimizer relies on it to recycle individuals instead of allocating new ones.
  */
 
 class ga_individual {
 public:
     virtual ~ga_individual() {}
     virtual ga_individual* clone() = 0;
+    virtual void copy_from(const ga_individual& other) = 0;
     double fitness = 0;
 };
 
-template<bool desc = false>
-struct compare {
-    bool operator()(const ga_individual *a, const ga_individual *b) {
-        return desc ? b->fitness < a->fitness : b->fitness > a->fitness;
+/// polymorphic individuals as ga_engine genomes: copied with copy_from(), or cloned into an empty slot
+template<>
+struct genome_traits<std::unique_ptr<ga_individual>> {
+    static void copy(std::unique_ptr<ga_individual>& dst, const std::unique_ptr<ga_individual>& src) {
+        if (dst) dst->copy_from(*src);
+        else dst.reset(src->clone());
     }
+    // individuals are opaque, so they cannot be hashed for the fitness cache (ga_optimizer never enables it)
+    static size_t hash(const std::unique_ptr<ga_individual>&) { throw "ga_individual genomes cannot be cached"; }
+    static bool equal(const std::unique_ptr<ga_individual>&, const std::unique_ptr<ga_individual>&) { return false; }
+    // nor serialized for checkpoints
+    static const bool checkpointable = false;
 };
 
-template<class Evaluator, class Creator, class CrossoverOp, class MutationOp>
+/**
+ * @brief Generational GA driver for polymorphic individuals and operators
+ *
+ * An adapter running ga_engine on ga_individual genomes, for operators derived from op_base. Every operator
+ * call goes through a virtual function, so new code with a fixed genome type should use ga_engine directly.
+ *
+ * The optimizer owns all its individuals: 2 * population size of them, allocated by initialize() and recycled
+ * afterwards. Selection copies parents with copy_from(), and reinsertion hands the individuals that did not
+ * survive back for the next generation, so a generation does not allocate and memory stays flat however long
+ * the run is.
+ *
+ * With threads > 1 the fitness evaluations are spread over a fixed pool of worker threads.
+ * Every worker gets its own evaluator, obtained once per run through Evaluator::clone() (worker 0
+ * uses eval itself), so the evaluators never share mutable state. Fitness values do not depend
+ * on the number of threads.
+ *
+ * Parent selection is a policy (see selection.h), roulette wheel by default. It is held by value in the
+ * selection member, so strategy parameters (tournament size, rank pressure) can be set on it directly.
+ */
+template<class Evaluator, class Creator, class CrossoverOp, class MutationOp, class SelectionOp = roulette_selection>
 class ga_optimizer {
+    typedef std::unique_ptr<ga_individual> genome;
+
+    struct creator_adapter {
+        void operator()(genome& g) { g.reset((*op)()); }
+        Creator *op;
+        rnd *r;
+    };
+
+    struct eval_adapter {
+        double operator()(const genome& g) { return g->fitness = (*op)(g.get()); }
+        eval_adapter* clone() const {
+            auto c = new eval_adapter;
+            c->owned.reset(op->clone());
+            c->op = c->owned.get();
+            c->r = r;
+            return c;
+        }
+        Evaluator *op;
+        std::unique_ptr<Evaluator> owned; // set for the per-worker copies
+        rnd *r;
+    };
+
+    struct crossover_adapter {
+        void operator()(genome& a, genome& b) { (*op)(a.get(), b.get()); }
+        CrossoverOp *op;
+        rnd *r;
+    };
+
+    struct mutation_adapter {
+        void operator()(genome& a) { (*op)(a.get()); }
+        MutationOp *op;
+        rnd *r;
+    };
+
+    typedef ga_engine<genome, eval_adapter, creator_adapter, crossover_adapter, mutation_adapter, SelectionOp> adapted_engine;
+
 public:
     ga_optimizer(int pop_size) :
-        initialized(false),
-        population_size(pop_size),
-        elites(1),
+        threads(1),
         create(nullptr),
         eval(nullptr),
         crossoverOp(nullptr),
-        mutateOp(nullptr){}
+        mutateOp(nullptr),
+        observer(nullptr),
+        r(nullptr),
+        engine(pop_size) {}
 
     void start(int generations) {
         std::cout << "--- Start" << std::endl;
         initialize(); // initialize population
-        for (int i = 0; i != generations; ++i) {
-//            std::cout << "--- Generation " << i << ", Best fitness: " << pop[0]->fitness << std::endl;
-            do_select();
-            do_crossover();
-            do_mutation();
-            do_evaluate(sel);
-            do_reinsert();
+        evolve(generations);
+    }
+
+    /// creates and evaluates the initial population
+    void initialize() {
+        bind();
+        engine.initialize();
+        update_view();
+    }
+
+    /// runs the given number of generations on the current population (initialize() must have been called).
+    /// the operators and settings are handed to the engine again, so changes made since initialize() apply
+    void evolve(int generations) {
+        bind();
+        engine.evolve(generations);
+        update_view();
+    }
+
+    /// the population, sorted descending by fitness (after initialize() or evolve())
+    const std::vector<ga_individual*>& population() const { return view; }
+
+    /// overwrites the worst individuals with copies of the given ones (used for migration between islands)
+    void immigrate(const std::vector<ga_individual*>& migrants) {
+        std::vector<typename adapted_engine::member_type> copies(migrants.size());
+        std::vector<const typename adapted_engine::member_type*> incoming;
+        for (size_t i = 0; i != migrants.size(); ++i) {
+            copies[i].genome.reset(migrants[i]->clone());
+            copies[i].fitness = migrants[i]->fitness;
+            incoming.push_back(&copies[i]);
         }
-        const bool descending = true;
-        std::sort(begin(pop), end(pop), compare<descending>()); // sort descending by fitness
+        engine.immigrate(incoming);
+        update_view();
     }
 
     ga_individual* best() {
-        return pop.front();
+        return view.front();
     }
 
     void set_random(rnd *r) {
@@ -73,82 +161,52 @@ public:
         eval->r = r;
         crossoverOp->r = r;
         mutateOp->r = r;
+        selection.r = r;
     }
 
     double mutation_probability;
+    int threads; // number of threads used for fitness evaluation
 
     Creator *create;
     Evaluator *eval;
     CrossoverOp *crossoverOp;
     MutationOp *mutateOp;
+    SelectionOp selection;
+    ga_observer *observer; // receives the telemetry of every generation, if set (see ga_engine)
 
 private:
-    void initialize() {
-		pop.clear();
-        pop.resize(population_size);
-        for(int i = 0; i != pop.size(); ++i)  {
-            pop[i] = (*create)();
-        }
-        sel.resize(pop.size());
-        do_evaluate(pop);
-        initialized = true;
+    /// hands the operators and settings to the engine
+    void bind() {
+        create_adapter.op = create;
+        evaluator.op = eval;
+        crossover.op = crossoverOp;
+        mutation.op = mutateOp;
+        engine.create = &create_adapter;
+        engine.eval = &evaluator;
+        engine.crossoverOp = &crossover;
+        engine.mutateOp = &mutation;
+        engine.selection = selection;
+        engine.set_random(r);
+        engine.mutation_probability = mutation_probability;
+        engine.threads = threads;
+        engine.observer = observer;
     }
 
-    void do_select() {
-        sel.clear();
-        sel.resize(pop.size());
-        std::vector<double> partials;
-        double sum = 0;
-        for (auto ind : pop) {
-            sum += ind->fitness;
-            partials.push_back(sum);
-        }
-        for (int i = 0; i != pop.size(); ++i) {
-            double d = r->next_double(sum);
-            int j = 0;
-            while (d > partials[j]) ++j;
-            if (j == pop.size()) {
-                std::cerr << "--- Warning: index exceeded. Adjusting." << std::endl;
-                --j;
-            }
-            sel[i] = pop[j]->clone();
-        }
+    void update_view() {
+        auto & pop = engine.population();
+        view.resize(pop.size());
+        for (size_t i = 0; i != pop.size(); ++i)
+            view[i] = pop[i]->genome.get();
     }
 
-    void do_reinsert() {
-        const bool descending = true;
-        std::sort(begin(sel), end(sel), compare<descending>());
-        std::merge(begin(pop), begin(pop)+elites, begin(sel)+elites, end(sel), begin(pop), compare<descending>());
-    }
-
-    void do_crossover() {
-        for (auto ind : sel) {
-            auto mate = sel[r->next(pop.size()-1)];
-            (*crossoverOp)(ind, mate);
-        }
-    }
-
-    void do_mutation() {
-        for (auto ind : sel) {
-            if (r->next_double() < mutation_probability)
-                (*mutateOp)(ind);
-        }
-    }
-
-    void do_evaluate(std::vector<ga_individual*>& individuals) {
-        for (auto & ind : individuals) {
-            ind->fitness = (*eval)(ind);
-        }
-    }
-
-    std::vector<ga_individual*> pop;
-    std::vector<ga_individual*> sel;
+    creator_adapter create_adapter;
+    eval_adapter evaluator;
+    crossover_adapter crossover;
+    mutation_adapter mutation;
 
     rnd *r;
-    bool initialized;
-    int population_size;
-    int elites;
-
+    adapted_engine engine;
+    std::vector<ga_individual*> view; // the engine's population, as ga_individual pointers
 };
 
 #endif // GA_H
@@ -0,0 +1,149 @@
+#ifndef ISLAND_H
+#define ISLAND_H
+
+#include "engine.h"
+
+enum migration_topology {
+    ring_topology, // island i sends its migrants to island i+1
+    fully_connected_topology // every island sends its migrants to every other island
+};
+
+/**
+ * @brief Island model on top of ga_engine
+ *
+ * The population is split into a number of islands, each evolved by its own ga_engine with its own
+ * random number generator (split from the master one, see rnd::split()) and its own copies of the operators (Evaluator::clone(), copy construction for
+ * the others). The islands run concurrently for migration_interval generations, then the best migrants
+ * individuals of every island replace the worst ones of its neighbours in the chosen topology. This is the
+ * only point where islands synchronize. Runs are reproducible for a given seed whatever the thread count,
+ * since an island only depends on its own generator and on the migrants it receives.
+ */
+template<class Genome, class Evaluator, class Creator, class CrossoverOp, class MutationOp, class SelectionOp = roulette_selection>
+class island_optimizer {
+public:
+    typedef ga_engine<Genome, Evaluator, Creator, CrossoverOp, MutationOp, SelectionOp> optimizer_type;
+    typedef typename optimizer_type::member_type member_type;
+
+    island_optimizer(int count, int size) :
+        mutation_probability(0.25),
+        migration_interval(10),
+        migrants(1),
+        topology(ring_topology),
+        threads(1),
+        fitness_cache_size(0),
+        create(nullptr),
+        eval(nullptr),
+        crossoverOp(nullptr),
+        mutateOp(nullptr),
+        r(nullptr),
+        island_count(count),
+        island_size(size) {}
+
+    void start(int generations) {
+        std::cout << "--- Start (" << island_count << " islands)" << std::endl;
+        setup_islands();
+        worker_pool pool(threads < 1 ? 1 : threads);
+        pool.run(islands.size(), [&](int, size_t begin, size_t end) {
+            for (size_t i = begin; i != end; ++i) islands[i].opt->initialize();
+        });
+        const int interval = migration_interval < 1 ? generations : migration_interval;
+        for (int g = 0; g < generations; g += interval) {
+            const int steps = std::min(interval, generations - g);
+            pool.run(islands.size(), [&](int, size_t begin, size_t end) {
+                for (size_t i = begin; i != end; ++i) islands[i].opt->evolve(steps);
+            });
+            if (g + steps < generations) migrate();
+        }
+    }
+
+    /// the best individual over all islands
+    member_type* best() {
+        member_type *b = nullptr;
+        for (auto & island : islands) {
+            auto c = island.opt->population().front();
+            if (b == nullptr || c->fitness > b->fitness) b = c;
+        }
+        return b;
+    }
+
+    void set_random(rnd *r) { this->r = r; }
+
+    /// settings applied to every island
+    double mutation_probability;
+    int migration_interval; // generations between migrations
+    int migrants; // individuals sent by every island at each migration
+    migration_topology topology;
+    int threads; // islands evolved concurrently
+    size_t fitness_cache_size; // slots of every island's fitness cache, 0 for none
+
+    /// prototypes of the operators, copied for every island
+    Creator *create;
+    Evaluator *eval;
+    CrossoverOp *crossoverOp;
+    MutationOp *mutateOp;
+    SelectionOp selection;
+
+private:
+    struct island {
+        std::unique_ptr<rnd> r;
+        std::unique_ptr<Creator> create;
+        std::unique_ptr<Evaluator> eval;
+        std::unique_ptr<CrossoverOp> crossoverOp;
+        std::unique_ptr<MutationOp> mutateOp;
+        std::unique_ptr<optimizer_type> opt;
+    };
+
+    void setup_islands() {
+        islands.clear();
+        islands.resize(island_count);
+        for (auto & island : islands) {
+            island.r.reset(new rnd(r->split())); // every island gets its own non-overlapping stream of the master generator
+            island.create.reset(new Creator(*create));
+            island.eval.reset(eval->clone());
+            island.crossoverOp.reset(new CrossoverOp(*crossoverOp));
+            island.mutateOp.reset(new MutationOp(*mutateOp));
+            island.opt.reset(new optimizer_type(island_size));
+            island.opt->create = island.create.get();
+            island.opt->eval = island.eval.get();
+            island.opt->crossoverOp = island.crossoverOp.get();
+            island.opt->mutateOp = island.mutateOp.get();
+            island.opt->selection = selection;
+            island.opt->set_random(island.r.get());
+            island.opt->mutation_probability = mutation_probability;
+            island.opt->fitness_cache_size = fitness_cache_size;
+        }
+    }
+
+    void migrate() {
+        const size_t n = islands.size();
+        if (n < 2) return;
+        // copy all the emigrants first, so that an island never forwards individuals it just received
+        std::vector<std::vector<member_type>> emigrants(n);
+        for (size_t i = 0; i != n; ++i) {
+            auto & pop = islands[i].opt->population();
+            const size_t count = std::min<size_t>(std::max(migrants, 0), pop.size());
+            emigrants[i].resize(count);
+            for (size_t k = 0; k != count; ++k) {
+                genome_traits<Genome>::copy(emigrants[i][k].genome, pop[k]->genome);
+                emigrants[i][k].fitness = pop[k]->fitness;
+            }
+        }
+        std::vector<const member_type*> incoming;
+        for (size_t i = 0; i != n; ++i) {
+            incoming.clear();
+            for (size_t j = 0; j != n; ++j) {
+                bool sends = topology == ring_topology ? j == (i + n - 1) % n : j != i;
+                if (!sends) continue;
+                for (auto & m : emigrants[j]) incoming.push_back(&m);
+            }
+            islands[i].opt->immigrate(incoming);
+        }
+    }
+
+    std::vector<island> islands;
+    rnd *r;
+    int island_count;
+    int island_size;
+};
+
+#endif // ISLAND_H
@@ -0,0 +1,173 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include "../random/random.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+
+/**
+ * Selection strategies for ga_optimizer.
+ *
+ * prepare(pop) is called once per generation with the current population, then operator()() is called
+ * once for every individual to select and returns an index into pop. Buffers are kept between generations,
+ * so selection does not allocate once the population size is stable.
+ *
+ * roulette_selection and alias_selection are fitness proportionate and expect non-negative fitness (negative
+ * values count as zero, an all-zero population is sampled uniformly). tournament_selection and rank_selection
+ * only compare fitness values, so any sign is fine.
+ */
+
+/// Walker/Vose alias table: O(n) construction, O(1) sampling from a discrete distribution
+class alias_table {
+public:
+    /// weights must be non-negative. if they sum to zero the distribution is uniform
+    void build(const std::vector<double>& weights) {
+        const size_t n = weights.size();
+        prob.resize(n);
+        alias.resize(n);
+        small.clear();
+        large.clear();
+        double sum = 0;
+        for (auto w : weights) sum += w;
+        for (size_t i = 0; i != n; ++i) {
+            prob[i] = sum > 0 ? weights[i] * n / sum : 1.0;
+            (prob[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            size_t s = small.back(), l = large.back();
+            small.pop_back();
+            alias[s] = l;
+            prob[l] -= 1.0 - prob[s];
+            if (prob[l] < 1.0) { large.pop_back(); small.push_back(l); }
+        }
+        // whatever is left is 1 up to rounding errors
+        for (auto i : small) { prob[i] = 1.0; alias[i] = i; }
+        for (auto i : large) { prob[i] = 1.0; alias[i] = i; }
+    }
+
+    size_t sample(rnd *r) const {
+        size_t i = r->next(prob.size() - 1);
+        return r->next_double() < prob[i] ? i : alias[i];
+    }
+
+    size_t size() const { return prob.size(); }
+
+private:
+    std::vector<double> prob;
+    std::vector<size_t> alias;
+    std::vector<size_t> small, large; // work lists, kept to avoid reallocating
+};
+
+/// fitness proportionate selection by binary search over the cumulative fitness: O(n) prepare, O(log n) per pick
+class roulette_selection {
+public:
+    template<typename Individual>
+    void prepare(const std::vector<Individual*>& pop) {
+        partials.resize(pop.size());
+        double sum = 0;
+        for (size_t i = 0; i != pop.size(); ++i) {
+            sum += std::max(0.0, pop[i]->fitness);
+            partials[i] = sum;
+        }
+    }
+
+    size_t operator()() {
+        const double sum = partials.back();
+        if (sum <= 0) return r->next(partials.size() - 1);
+        double d = r->next_double(sum);
+        size_t j = std::lower_bound(partials.begin(), partials.end(), d) - partials.begin();
+        return std::min(j, partials.size() - 1);
+    }
+
+    rnd *r = nullptr;
+
+private:
+    std::vector<double> partials;
+};
+
+/// fitness proportionate selection with an alias table: O(n) prepare, O(1) per pick
+class alias_selection {
+public:
+    template<typename Individual>
+    void prepare(const std::vector<Individual*>& pop) {
+        weights.resize(pop.size());
+        for (size_t i = 0; i != pop.size(); ++i)
+            weights[i] = std::max(0.0, pop[i]->fitness);
+        table.build(weights);
+    }
+
+    size_t operator()() { return table.sample(r); }
+
+    rnd *r = nullptr;
+
+private:
+    std::vector<double> weights;
+    alias_table table;
+};
+
+/// k-tournament: the best of tournament_size individuals drawn uniformly (with replacement). O(k) per pick
+class tournament_selection {
+public:
+    template<typename Individual>
+    void prepare(const std::vector<Individual*>& pop) {
+        fitness.resize(pop.size());
+        for (size_t i = 0; i != pop.size(); ++i)
+            fitness[i] = pop[i]->fitness;
+    }
+
+    size_t operator()() {
+        const int last = fitness.size() - 1;
+        size_t best = r->next(last);
+        for (int k = 1; k < tournament_size; ++k) {
+            size_t c = r->next(last);
+            if (fitness[c] > fitness[best]) best = c;
+        }
+        return best;
+    }
+
+    int tournament_size = 2;
+    rnd *r = nullptr;
+
+private:
+    std::vector<double> fitness;
+};
+
+/// Linear ranking: the individual of rank i (0 = worst, n-1 = best) is picked with probability
+/// (2 - s) / n + 2 i (s - 1) / (n (n - 1)), where s in [1, 2] is the selection pressure (the expected number
+/// of copies of the best individual). The rank distribution only depends on n and s, so its alias table is
+/// only rebuilt when they change. O(n log n) prepare (O(n) if pop is already sorted), O(1) per pick.
+class rank_selection {
+public:
+    template<typename Individual>
+    void prepare(const std::vector<Individual*>& pop) {
+        const size_t n = pop.size();
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0);
+        // order[rank] = index, ascending by fitness (ga_optimizer keeps pop sorted descending)
+        auto worse = [&](size_t a, size_t b) { return pop[a]->fitness < pop[b]->fitness; };
+        std::reverse(order.begin(), order.end());
+        if (!std::is_sorted(order.begin(), order.end(), worse))
+            std::sort(order.begin(), order.end(), worse);
+        if (table.size() != n || pressure != built_pressure) {
+            ranks.resize(n);
+            for (size_t i = 0; i != n; ++i)
+                ranks[i] = n > 1 ? (2 - pressure) / n + 2.0 * i * (pressure - 1) / (n * (n - 1.0)) : 1.0;
+            table.build(ranks);
+            built_pressure = pressure;
+        }
+    }
+
+    size_t operator()() { return order[table.sample(r)]; }
+
+    double pressure = 1.5;
+    rnd *r = nullptr;
+
+private:
+    std::vector<size_t> order;
+    std::vector<double> ranks;
+    double built_pressure = -1;
+    alias_table table;
+};
+
+#endif // SELECTION_H
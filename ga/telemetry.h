@@ -0,0 +1,90 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <ostream>
+#include <cstddef>
+
+/// what happened during one generation. generation 0 is the initial population, for which only the
+/// evaluation is timed. the fitness statistics are those of the population after reinsertion.
+struct generation_stats {
+    int generation = 0;
+    double select_seconds = 0;
+    double crossover_seconds = 0;
+    double mutation_seconds = 0;
+    double evaluate_seconds = 0;
+    double reinsert_seconds = 0;
+    size_t evaluations = 0; // fitness evaluations in this generation
+    size_t unchanged = 0; // offspring left untouched by crossover and mutation, not evaluated
+    size_t cache_hits = 0; // changed offspring whose fitness was found in the fitness cache
+    size_t total_evaluations = 0; // since initialize()
+    double evaluations_per_second = 0; // evaluations / evaluate_seconds
+    double best_fitness = 0;
+    double mean_fitness = 0;
+    double fitness_stddev = 0;
+
+    double total_seconds() const {
+        return select_seconds + crossover_seconds + mutation_seconds + evaluate_seconds + reinsert_seconds;
+    }
+};
+
+/**
+ * @brief Receives per-generation telemetry from a GA
+ *
+ * Attach one through the optimizer's observer member. Without an observer the optimizer does not read
+ * the clock or compute any statistics. on_generation() is called on the thread running the optimizer.
+ */
+class ga_observer {
+public:
+    virtual ~ga_observer() {}
+    virtual void on_generation(const generation_stats& s) = 0;
+};
+
+/// streams the telemetry as CSV, one line per generation after a header line
+class csv_observer : public ga_observer {
+public:
+    explicit csv_observer(std::ostream& out) : out(out), header(false) {}
+
+    void on_generation(const generation_stats& s) {
+        if (!header) {
+            out << "generation,select_s,crossover_s,mutation_s,evaluate_s,reinsert_s,evaluations,unchanged,cache_hits,"
+                   "total_evaluations,evaluations_per_s,best,mean,stddev\n";
+            header = true;
+        }
+        out << s.generation << ',' << s.select_seconds << ',' << s.crossover_seconds << ',' << s.mutation_seconds << ','
+            << s.evaluate_seconds << ',' << s.reinsert_seconds << ',' << s.evaluations << ',' << s.unchanged << ','
+            << s.cache_hits << ',' << s.total_evaluations << ',' << s.evaluations_per_second << ',' << s.best_fitness << ','
+            << s.mean_fitness << ',' << s.fitness_stddev << '\n';
+    }
+
+private:
+    std::ostream& out;
+    bool header;
+};
+
+/// streams the telemetry as JSON lines, one object per generation
+class json_observer : public ga_observer {
+public:
+    explicit json_observer(std::ostream& out) : out(out) {}
+
+    void on_generation(const generation_stats& s) {
+        out << "{\"generation\": " << s.generation
+            << ", \"select_s\": " << s.select_seconds
+            << ", \"crossover_s\": " << s.crossover_seconds
+            << ", \"mutation_s\": " << s.mutation_seconds
+            << ", \"evaluate_s\": " << s.evaluate_seconds
+            << ", \"reinsert_s\": " << s.reinsert_seconds
+            << ", \"evaluations\": " << s.evaluations
+            << ", \"unchanged\": " << s.unchanged
+            << ", \"cache_hits\": " << s.cache_hits
+            << ", \"total_evaluations\": " << s.total_evaluations
+            << ", \"evaluations_per_s\": " << s.evaluations_per_second
+            << ", \"best\": " << s.best_fitness
+            << ", \"mean\": " << s.mean_fitness
+            << ", \"stddev\": " << s.fitness_stddev << "}\n";
+    }
+
+private:
+    std::ostream& out;
+};
+
+#endif // TELEMETRY_H
@@ -1,4 +1,5 @@
 #include "ann/ann.h"
+#include "ann/model.h"
 #include "ann/train/train.h"
 #include "statistics/statistics.h"
 #include "random/random.h"
@@ -14,18 +15,24 @@ int main(void) {
 	//rand->seed(12345); // in case we need predictability and reproducibility when testing, we fix the seed 
 	unique_ptr<dataset> data;
 	try {
-		auto d = new dataset("ev_an.txt");
+		load_options options;
+		options.normalize = true;
+		options.cache = true; // repeated runs map ev_an.txt.cache instead of parsing and normalizing again
+		auto d = new dataset("ev_an.txt", options);
 		data.reset(d);
 	} catch(...) {
 		cout << "Error opening data file." << endl;
 		return 1;
 	}
 
-	cout << "Loaded " << data->rows.size() << " rows of data" << endl;
-	data->normalize();
+	cout << "Loaded " << data->rows() << " rows of data" << endl;
+	if (data->rows() == 0 || data->input_count() == 0) {
+		cout << "The data file needs at least one row and two columns." << endl;
+		return 1;
+	}
 	auto nn = unique_ptr<neural_net>(new neural_net);
-	// by convention, first n-1 columns in the dataset are the inputs while the last column is the target output (can easily be changed)
-	const int inputs = data->rows[0].size()-1;
+	// by default the last column in the dataset is the target output and the others are the inputs (see the dataset constructor)
+	const int inputs = data->input_count();
 	const int hidden_neurons = 5;
 	const int outputs = 1;
 
@@ -33,51 +40,40 @@ int main(void) {
 	nn->initialize(layer_dimensions, rand.get());
 
 	// split the dataset into training and test data by taking half-half
-	size_t training_rows = data->rows.size() / 2;
+	size_t training_rows = data->rows() / 2;
 //	size_t training_rows = 1;
 
 	vector<double> output_values(training_rows);
 	vector<double> target_values(training_rows);
 
 	// set learning parameters
-	double learning_rate = 0.1;
-  	int training_iterations = 2000;
-
 	int popsize = 100;
 	int generations = 500;
 	vector<int> indices;
-	for (int i = 0; i != training_rows; ++i)
+	for (size_t i = 0; i != training_rows; ++i)
 		indices.push_back(i);
-	ga_train(nn.get(), rand.get(), data.get(), indices, generations, popsize);
-
-	// commence training
-//	for (int i = 0; i != training_iterations; ++i) {
-//		for(size_t row = 0; row != training_rows; ++row) {
-//			nn->update(data.get(), row);
-//            backprop(nn.get(), learning_rate, data.get(), row); // do the actual training
-//		}
-//	}
-	// get values after training
+	ga_train(nn.get(), rand.get(), data.get(), indices, generations, popsize); // see README for the other trainers
+	// get values after training (in this case we know we have one single output)
+	nn->predict(data.get(), indices, output_values);
 	for(size_t row = 0; row != training_rows; ++row) {
-		nn->update(data.get(), row);
-		double v = nn->layers.back()[0]->value; // in this case we know we have one single output
-		target_values[row] = data->rows[row].back();
-		output_values[row] = v;
+		target_values[row] = data->target(row);
 	}
 	
 	// apply linear scaling on the network's output (weird, but this works)
-	auto scaling_calculator = unique_ptr<lsp_calculator>(new lsp_calculator);
-	for(size_t i = 0; i != output_values.size(); ++i)
-		scaling_calculator->add(output_values[i], target_values[i]);
-	double alpha = scaling_calculator->Alpha();
-	double beta = scaling_calculator->Beta();
+	// alpha, beta, R2 and the scaled MSE come out of a single pass over the values
+	auto fitness_calculator = unique_ptr<scaled_fitness_calculator>(new scaled_fitness_calculator);
+	fitness_calculator->add(output_values.data(), target_values.data(), output_values.size());
+	auto training_fitness = fitness_calculator->result();
 
 	for(auto & v : output_values)
-		v = alpha + v * beta;
-	
-	auto r2calc = unique_ptr<rsquared_calculator>(new rsquared_calculator);
-	double r2training = r2calc->calculate(output_values, target_values);
-	cout << "Pearson's R2 (training): " << r2training << endl;
+		v = training_fitness.alpha + v * training_fitness.beta;
+
+	cout << "Pearson's R2 (training): " << training_fitness.rsquared << endl;
+	cout << "Scaled MSE (training): " << training_fitness.mse << endl;
+
+	// save the trained network with its normalization and scaling, for inference_model (see ann/inference.h)
+	if (!write_model("model.bin", *nn, data->normalization(), training_fitness.alpha, training_fitness.beta))
+		cout << "Error writing model.bin" << endl;
 
 	// write training values to file
 	ofstream f("training.out");
@@ -86,27 +82,25 @@ int main(void) {
 	}
 	f.close();
 	// reinitialize and reuse these variables
-	output_values = vector<double>(data->rows.size()-training_rows);
-	target_values = vector<double>(data->rows.size()-training_rows);
-
-	for (size_t row = training_rows; row != data->rows.size(); ++row) {
-		nn->update(data.get(), row); 
-		double v = nn->layers.back()[0]->value; // in this case we know we have one single output
-		target_values[row-training_rows] = data->rows[row].back();
-		output_values[row-training_rows] = v;
+	output_values = vector<double>(data->rows()-training_rows);
+	target_values = vector<double>(data->rows()-training_rows);
+
+	vector<int> test_indices;
+	for (size_t row = training_rows; row != data->rows(); ++row) {
+		test_indices.push_back(row);
+		target_values[row-training_rows] = data->target(row);
 	}
+	nn->predict(data.get(), test_indices, output_values);
 	// scaling
-	scaling_calculator->reset();
-	for(size_t i = 0; i != output_values.size(); ++i)
-		scaling_calculator->add(output_values[i], target_values[i]);
-	alpha = scaling_calculator->Alpha();
-	beta = scaling_calculator->Beta();
+	fitness_calculator->reset();
+	fitness_calculator->add(output_values.data(), target_values.data(), output_values.size());
+	auto test_fitness = fitness_calculator->result();
 
 	for(auto & v : output_values)
-		v = alpha + v * beta;
+		v = test_fitness.alpha + v * test_fitness.beta;
 
-	double r2test = r2calc->calculate(output_values, target_values);
-	cout << "Pearson's R2 (test): " << r2test << endl;
+	cout << "Pearson's R2 (test): " << test_fitness.rsquared << endl;
+	cout << "Scaled MSE (test): " << test_fitness.mse << endl;
 
 	// write test values to file
 	ofstream f1("test.out");
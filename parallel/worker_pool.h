@@ -0,0 +1,123 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <cstddef>
+
+/**
+ * @brief A fixed set of threads running data-parallel loops
+ *
+ * run(n, f) splits [0, n) into one contiguous chunk per worker and calls f(worker, begin, end) for every chunk.
+ * The calling thread acts as worker 0, so a pool of size 1 runs everything inline without any synchronization.
+ * The split only depends on n and the pool size, so a worker always sees the same chunk for the same input.
+ * If f throws, run() still waits for every chunk to finish, then rethrows the exception (worker 0's first, if several threw).
+ */
+class worker_pool {
+public:
+    typedef std::function<void(int, size_t, size_t)> task_type;
+
+    explicit worker_pool(int size) : workers(size < 1 ? 1 : size), generation(0), pending(0), stop(false) {
+        for (int i = 1; i < workers; ++i)
+            threads.push_back(std::thread(&worker_pool::loop, this, i));
+    }
+
+    ~worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto & t : threads) t.join();
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    int size() const { return workers; }
+
+    /// number of threads the hardware can run concurrently (at least 1)
+    static int hardware_threads() {
+        int n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    /// blocks until f has been called on every chunk of [0, n). rethrows what f threw, if anything
+    void run(size_t n, const task_type& f) {
+        if (workers == 1 || n <= 1) {
+            f(0, 0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &f;
+            count = n;
+            pending = workers - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        std::exception_ptr caught;
+        try {
+            f(0, 0, chunk_end(0, n));
+        } catch (...) {
+            caught = std::current_exception();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+        task = nullptr;
+        if (!caught) caught = error;
+        error = nullptr;
+        lock.unlock();
+        if (caught) std::rethrow_exception(caught);
+    }
+
+private:
+    size_t chunk_begin(int worker, size_t n) const { return n * worker / workers; }
+    size_t chunk_end(int worker, size_t n) const { return n * (worker + 1) / workers; }
+
+    void loop(int worker) {
+        size_t seen = 0;
+        for (;;) {
+            const task_type *f;
+            size_t n;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+                f = task;
+                n = count;
+            }
+            size_t begin = chunk_begin(worker, n), end = chunk_end(worker, n);
+            std::exception_ptr caught;
+            try {
+                if (begin != end) (*f)(worker, begin, end);
+            } catch (...) {
+                caught = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (caught && !error) error = caught;
+                --pending;
+            }
+            done.notify_one();
+        }
+    }
+
+    int workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const task_type *task = nullptr;
+    size_t count = 0;
+    std::exception_ptr error; // the first exception a worker thread caught in the current run
+    size_t generation;
+    int pending;
+    bool stop;
+};
+
+#endif // WORKER_POOL_H
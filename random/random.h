@@ -3,48 +3,170 @@
 
 #include <random>
 #include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
 
-typedef std::mt19937 engine_type;
+/// xoshiro256++ (Blackman and Vigna): 256 bits of state, a period of 2^256 - 1, and jumps of 2^128 and
+/// 2^192 steps that split the period into non-overlapping streams. A UniformRandomBitGenerator, so it also
+/// works with the standard distributions
+class xoshiro256pp {
+public:
+    typedef uint64_t result_type;
+
+    explicit xoshiro256pp(result_type s = 0) { seed(s); }
+
+    /// the state is filled by splitmix64 from s, so that close seeds give unrelated states
+    void seed(result_type s) {
+        for (auto & x : state) {
+            uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            x = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator()() {
+        const uint64_t result = rotl(state[0] + state[3], 23) + state[0];
+        const uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    static const int state_size = 4; // 64-bit words
+
+    void get_state(uint64_t *s) const { for (int i = 0; i != state_size; ++i) s[i] = state[i]; }
+    void set_state(const uint64_t *s) { for (int i = 0; i != state_size; ++i) state[i] = s[i]; }
+
+    /// advances the state by 2^128 steps
+    void jump() {
+        static const uint64_t polynomial[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+        jump(polynomial);
+    }
+
+    /// advances the state by 2^192 steps
+    void long_jump() {
+        static const uint64_t polynomial[] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+        jump(polynomial);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    void jump(const uint64_t *polynomial) {
+        uint64_t s[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i != 4; ++i)
+            for (int b = 0; b != 64; ++b) {
+                if (polynomial[i] & (uint64_t(1) << b))
+                    for (int j = 0; j != 4; ++j) s[j] ^= state[j];
+                (*this)();
+            }
+        for (int j = 0; j != 4; ++j) state[j] = s[j];
+    }
+
+    uint64_t state[4];
+};
+
+typedef xoshiro256pp engine_type;
 
 // implementation
+// no distribution objects: doubles take the top 53 bits of an output, and integers use Lemire's
+// multiply-and-reject, which almost never needs a division
 class rnd {
 public:
 	rnd() {
 		std::random_device rd;
-		twister = engine_type(rd());
+		seed((engine_type::result_type(rd()) << 32) | rd());
 	}
+    /// uniform in [0, end]
     int next(int end) {
         if (end == 0) return 0;
-        std::uniform_int_distribution<int> dist(0, end);
-        return dist(twister);
+        return (int)below(uint32_t(end) + 1);
     }
 
+    /// uniform in [begin, end]
     int next(int begin, int end) {
         if (begin == end) return begin;
-        std::uniform_int_distribution<int> dist(begin, end);
-        return dist(twister);
+        return (int)(uint32_t(begin) + below(uint32_t(end) - uint32_t(begin) + 1));
     }
 
+    /// uniform in [0, 1)
     double next_double() {
-        std::uniform_real_distribution<double> real(0,1);
-        return real(twister);
+        return (engine() >> 11) * (1.0 / 9007199254740992.0);
     }
 
     double next_double(double end) {
         if (end == 0) return 0;
-        std::uniform_real_distribution<double> real(0, end);
-        return real(twister);
+        return next_double() * end;
     }
 
     double next_double(double begin, double end) {
         if (begin == end) return begin;
-        std::uniform_real_distribution<double> real(begin, end);
-        return real(twister);
+        return begin + next_double() * (end - begin);
+    }
+
+    /// n values uniform in [begin, end), drawn in double (T is double or float)
+    template<typename T>
+    void fill_uniform(T *out, size_t n, double begin = 0, double end = 1) {
+        const double scale = (end - begin) * (1.0 / 9007199254740992.0);
+        for (size_t i = 0; i != n; ++i)
+            out[i] = begin + (engine() >> 11) * scale;
+    }
+
+    /// n normally distributed values (Marsaglia's polar method: two values per accepted point of the unit
+    /// disc, one logarithm and no trigonometry)
+    template<typename T>
+    void fill_normal(T *out, size_t n, double mean = 0, double stddev = 1) {
+        for (size_t i = 0; i < n; i += 2) {
+            double x, y, s;
+            do {
+                x = 2 * next_double() - 1;
+                y = 2 * next_double() - 1;
+                s = x * x + y * y;
+            } while (s >= 1 || s == 0);
+            const double f = stddev * std::sqrt(-2 * std::log(s) / s);
+            out[i] = mean + f * x;
+            if (i + 1 != n) out[i + 1] = mean + f * y;
+        }
+    }
+
+    void seed(engine_type::result_type s) { engine.seed(s); }
+
+    /// the generator's position (engine_type::state_size words), to save it and continue from it later
+    void get_state(uint64_t *s) const { engine.get_state(s); }
+    void set_state(const uint64_t *s) { engine.set_state(s); }
+
+    /// a generator for another thread: it continues this one's sequence, while this one jumps 2^128 values
+    /// ahead. successive splits of a seeded generator give the same non-overlapping streams on every run
+    rnd split() {
+        rnd r(*this);
+        engine.jump();
+        return r;
     }
-    void seed(engine_type::result_type s) { twister.seed(s); }
 
 private:
-    engine_type twister;
+    /// uniform in [0, range), range 0 standing for 2^32
+    uint32_t below(uint32_t range) {
+        const uint32_t x = uint32_t(engine() >> 32);
+        if (range == 0) return x;
+        uint64_t m = uint64_t(x) * range;
+        if (uint32_t(m) < range) {
+            const uint32_t threshold = uint32_t(-range) % range;
+            while (uint32_t(m) < threshold)
+                m = uint64_t(uint32_t(engine() >> 32)) * range;
+        }
+        return uint32_t(m >> 32);
+    }
+
+    engine_type engine;
 };
 
 #endif // RANDOM_H
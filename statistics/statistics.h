@@ -5,9 +5,50 @@
 #include <algorithm>
 #include <memory>
 #include <iostream>
+#include <cmath>
+#include <limits>
 
 const double eps = std::numeric_limits<double>::epsilon();
 
+/// The accumulators below keep a count, the means and the sums of squared deviations from the mean
+/// (co-moments), so two of them can be combined exactly with merge() (Chan, Golub & LeVeque, "Updating
+/// formulae and a pairwise algorithm for computing sample variances", 1979). Per-thread or per-chunk
+/// accumulators can be merged at the end instead of feeding everything through one of them.
+/// The bulk add(values, n) overloads work on blocks of block_size values: two passes over a block
+/// (sums, then deviations from the block means) with independent partial sums that the compiler keeps in
+/// vector registers, and one merge per block instead of one division per value. They take float or double
+/// values; the sums are always accumulated in double.
+namespace stats_detail {
+	const size_t block_size = 1024;
+
+	/// sum of x[0..n), four partial sums
+	template<typename T>
+	inline double sum(const T *x, size_t n) {
+		double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			s0 += x[i]; s1 += x[i+1]; s2 += x[i+2]; s3 += x[i+3];
+		}
+		for (; i != n; ++i) s0 += x[i];
+		return (s0 + s1) + (s2 + s3);
+	}
+
+	/// sum of (x - mx)(y - my) over [0..n)
+	template<typename T>
+	inline double comoment(const T *x, double mx, const T *y, double my, size_t n) {
+		double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			s0 += (x[i] - mx) * (y[i] - my);
+			s1 += (x[i+1] - mx) * (y[i+1] - my);
+			s2 += (x[i+2] - mx) * (y[i+2] - my);
+			s3 += (x[i+3] - mx) * (y[i+3] - my);
+		}
+		for (; i != n; ++i) s0 += (x[i] - mx) * (y[i] - my);
+		return (s0 + s1) + (s2 + s3);
+	}
+}
+
 class mv_calculator {
 	public:
 		mv_calculator() { reset(); }
@@ -25,27 +66,58 @@ class mv_calculator {
 				old_var = new_var; 
 			}
 		}
+		/// adds count values at once
+		template<typename T>
+		void add(const T *x, size_t count) {
+			for (size_t i = 0; i < count; i += stats_detail::block_size) {
+				const size_t m = std::min(count - i, stats_detail::block_size);
+				const double mean = stats_detail::sum(x + i, m) / m;
+				merge(m, mean, stats_detail::comoment(x + i, mean, x + i, mean, m));
+			}
+		}
+		/// combines the values added to other with these
+		void merge(const mv_calculator& other) {
+			if (other.n > 0) merge(other.n, other.new_mean, other.n > 1 ? other.new_var : 0.0);
+		}
+		/// combines count values of the given mean and sum of squared deviations (m2) with these
+		void merge(size_t count, double mean, double m2) {
+			if (count == 0) return;
+			if (n == 0) {
+				n = count;
+				old_mean = new_mean = mean;
+				old_var = new_var = m2;
+				return;
+			}
+			const size_t total = n + count;
+			const double delta = mean - new_mean;
+			new_mean += delta * count / total;
+			new_var = (n > 1 ? new_var : 0.0) + m2 + delta * delta * ((double)n * count / total);
+			old_mean = new_mean;
+			old_var = new_var;
+			n = total;
+		}
 		void reset() { n = 0; }
-		double mean() {
+		size_t count() const { return n; }
+		double mean() const {
 			return n > 0 ? new_mean : 0.0;
 		}
 
-		double variance() {
+		double variance() const {
 			return  n > 1 ? new_var / (n - 1) : 0.0;
 		}
-		double stddev() {
+		double stddev() const {
 			return std::sqrt(variance());
 		}
 	private:
 		double new_mean, old_mean, new_var, old_var;
-		int n; // number of elements
+		size_t n; // number of elements
 };
 
 class covariance_calculator {
 	public:
 		covariance_calculator() { reset(); }
 
-		double covariance() { return n > 0 ? cn / n : 0.0; }
+		double covariance() const { return n > 0 ? cn / n : 0.0; }
 		void reset() {
 			n = 0; x_mean = 0; y_mean = 0; cn = 0;
 		}
@@ -56,9 +128,33 @@ class covariance_calculator {
 			y_mean = y_mean + delta / n;
 			cn = cn + delta * (x - x_mean);
 		}
+		/// adds count pairs at once
+		template<typename T>
+		void add(const T *x, const T *y, size_t count) {
+			for (size_t i = 0; i < count; i += stats_detail::block_size) {
+				const size_t m = std::min(count - i, stats_detail::block_size);
+				const double mx = stats_detail::sum(x + i, m) / m, my = stats_detail::sum(y + i, m) / m;
+				merge(m, mx, my, stats_detail::comoment(x + i, mx, y + i, my, m));
+			}
+		}
+		void merge(const covariance_calculator& other) {
+			merge(other.n, other.x_mean, other.y_mean, other.cn);
+		}
+		/// combines count pairs of the given means and co-moment (sum of (x - mx)(y - my)) with these
+		void merge(size_t count, double mx, double my, double c) {
+			if (count == 0) return;
+			const size_t total = n + count;
+			const double dx = mx - x_mean, dy = my - y_mean;
+			const double f = (double)n * count / total;
+			x_mean += dx * count / total;
+			y_mean += dy * count / total;
+			cn += c + dx * dy * f;
+			n = total;
+		}
+		size_t count() const { return n; }
 	private:
 		double x_mean, y_mean, cn;
-		int n;
+		size_t n;
 };
 
 class rsquared_calculator {
@@ -73,6 +169,27 @@ class rsquared_calculator {
 			sy_calculator->add(y);
 			cov_calculator->add(x,y);
 		}
+		/// adds count pairs at once. the means of a block are computed once for the three co-moments,
+		/// and the block is still in cache when they are
+		template<typename T>
+		void add(const T *x, const T *y, size_t count) {
+			for (size_t i = 0; i < count; i += stats_detail::block_size) {
+				const size_t m = std::min(count - i, stats_detail::block_size);
+				const T *bx = x + i, *by = y + i;
+				const double mx = stats_detail::sum(bx, m) / m, my = stats_detail::sum(by, m) / m;
+				const double sxx = stats_detail::comoment(bx, mx, bx, mx, m);
+				const double syy = stats_detail::comoment(by, my, by, my, m);
+				const double sxy = stats_detail::comoment(bx, mx, by, my, m);
+				sx_calculator->merge(m, mx, sxx);
+				sy_calculator->merge(m, my, syy);
+				cov_calculator->merge(m, mx, my, sxy);
+			}
+		}
+		void merge(const rsquared_calculator& other) {
+			sx_calculator->merge(*other.sx_calculator);
+			sy_calculator->merge(*other.sy_calculator);
+			cov_calculator->merge(*other.cov_calculator);
+		}
 		void reset() {
 			sx_calculator->reset();
 			sy_calculator->reset();
@@ -80,9 +197,11 @@ class rsquared_calculator {
 		}
 		double calculate(std::vector<double>& original_values, std::vector<double>& estimated_values) {
 			// the two vectors should have the same size
-			for(size_t i = 0; i != original_values.size(); ++i) {
-				add(original_values[i], estimated_values[i]);
-			}
+			add(original_values.data(), estimated_values.data(), std::min(original_values.size(), estimated_values.size()));
+			return rsquared();
+		}
+		/// R2 of the values added so far
+		double rsquared() const {
 			double xvar = sx_calculator->variance();
 	        double yvar = sy_calculator->variance();
 			if( xvar < eps || yvar < eps)  { return 0.0;	}
@@ -97,6 +216,7 @@ class rsquared_calculator {
 
 // linear scaling parameter calculator
 // the reasons for scaling are explained in: http://www2.cs.uidaho.edu/~cs472_572/f11/scaledsymbolicRegression.pdf
+// add() only accumulates, alpha and beta are computed when asked for
 class lsp_calculator {
 	public: 
 		lsp_calculator() {
@@ -114,20 +234,91 @@ class lsp_calculator {
 			target_mean_calculator->add(target);
 			ov_calculator->add(original);
 			ot_calculator->add(original, target);
-
-			if (ov_calculator->variance() < eps) beta = 1;
-			else beta = ot_calculator->covariance() / ov_calculator->variance();
-			alpha = target_mean_calculator->mean() - beta * ov_calculator->mean(); 
 		}
-		double Beta() const { return beta; }
-		double Alpha() const { return alpha; }
+		/// adds count pairs at once
+		template<typename T>
+		void add(const T *original, const T *target, size_t count) {
+			target_mean_calculator->add(target, count);
+			ov_calculator->add(original, count);
+			ot_calculator->add(original, target, count);
+		}
+		void merge(const lsp_calculator& other) {
+			target_mean_calculator->merge(*other.target_mean_calculator);
+			ov_calculator->merge(*other.ov_calculator);
+			ot_calculator->merge(*other.ot_calculator);
+		}
+		double Beta() const {
+			if (ov_calculator->variance() < eps) return 1;
+			return ot_calculator->covariance() / ov_calculator->variance();
+		}
+		double Alpha() const { return target_mean_calculator->mean() - Beta() * ov_calculator->mean(); }
 	private:
-		double alpha; // additive constant 
-		double beta; // multiplicative factor
-
 		std::unique_ptr<mv_calculator> target_mean_calculator;
 		std::unique_ptr<mv_calculator> ov_calculator; // original values 
 		std::unique_ptr<covariance_calculator> ot_calculator; // original - target covariance calculator
 };
 
+/// everything needed to judge a model's predictions after linear scaling, t ~ alpha + beta * prediction
+struct scaled_fitness {
+	double alpha; // as lsp_calculator
+	double beta;
+	double rsquared; // as rsquared_calculator (scaling does not change it)
+	double mse; // mean squared error of the scaled predictions
+};
+
+/// Computes scaled_fitness from a single pass over (prediction, target) pairs. The means and co-moments
+/// that lsp_calculator and rsquared_calculator need are the same, so they are only accumulated once,
+/// and the MSE of the scaled predictions follows from them without applying the scaling:
+/// the scaled residuals have zero mean, so MSE = (beta^2 Spp - 2 beta Spt + Stt) / n.
+class scaled_fitness_calculator {
+	public:
+		void reset() {
+			predictions.reset();
+			targets.reset();
+			cov.reset();
+		}
+		void add(double prediction, double target) {
+			predictions.add(prediction);
+			targets.add(target);
+			cov.add(prediction, target);
+		}
+		/// adds count pairs at once: per block, one pass for the means and one for every co-moment
+		template<typename T>
+		void add(const T *prediction, const T *target, size_t count) {
+			for (size_t i = 0; i < count; i += stats_detail::block_size) {
+				const size_t m = std::min(count - i, stats_detail::block_size);
+				const T *p = prediction + i, *t = target + i;
+				const double mp = stats_detail::sum(p, m) / m, mt = stats_detail::sum(t, m) / m;
+				predictions.merge(m, mp, stats_detail::comoment(p, mp, p, mp, m));
+				targets.merge(m, mt, stats_detail::comoment(t, mt, t, mt, m));
+				cov.merge(m, mp, mt, stats_detail::comoment(p, mp, t, mt, m));
+			}
+		}
+		void merge(const scaled_fitness_calculator& other) {
+			predictions.merge(other.predictions);
+			targets.merge(other.targets);
+			cov.merge(other.cov);
+		}
+		scaled_fitness result() const {
+			scaled_fitness f;
+			const double pvar = predictions.variance(), tvar = targets.variance(), c = cov.covariance();
+			f.beta = pvar < eps ? 1 : c / pvar;
+			f.alpha = targets.mean() - f.beta * predictions.mean();
+			if (pvar < eps || tvar < eps) f.rsquared = 0;
+			else {
+				const double r = c / (std::sqrt(pvar) * std::sqrt(tvar));
+				f.rsquared = r * r;
+			}
+			const size_t n = cov.count();
+			if (n == 0) { f.mse = 0; return f; }
+			// back to sums of squares: the variances are sample variances, the covariance a population one
+			const double spp = pvar * (n - 1), stt = tvar * (n - 1), spt = c * n;
+			f.mse = std::max(0.0, (f.beta * f.beta * spp - 2 * f.beta * spt + stt) / n);
+			return f;
+		}
+	private:
+		mv_calculator predictions, targets;
+		covariance_calculator cov;
+};
+
 #endif